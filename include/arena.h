@@ -2,276 +2,116 @@
 #include <iostream>
 #include <time.h>
 #include <vector>
-#include <future>
+#include <mutex>
 #include <sc2api/sc2_args.h>
 #include <sc2api/sc2_game_settings.h>
 #include <sc2api/sc2_proto_interface.h>
-#include <sc2api/sc2_connection.h>
 #include <sc2utils/sc2_manage_process.h>
 #include <arena_process.h>
 #include <arena_types.h>
+#include <bot_server.h>
+#include <game_connection.h>
+#include <map_catalog.h>
+#include <port_allocator.h>
+#include <resource_group.h>
+#include <sc2_pool.h>
+#include <relay_executor.h>
+#include <replay_archive.h>
 
 using namespace std;
 
-namespace Arena {
-	vector<Bot> bots;
-	size_t num_players;
-	vector<string> maps;
-	size_t num_maps;
+struct ArenaConfig;
 
-	sc2::ProtoInterface proto;
-	sc2::ProcessSettings process_settings;
-	sc2::GameSettings game_settings;
+// Everything one game owns. Matches share nothing, so several can be
+// played at once, each on its own leased port block.
+struct Match {
+	vector<Bot> bots;
+	string map;
+	// First port of this match's block, see Arena::bot_port and friends.
+	// Leased by Arena::play, 0 while the match holds no ports.
+	int port_start = 0;
 
+	// Bot processes and their cgroups, sc2 comes from the pool
 	vector<uint64_t> pids;
-	vector<sc2::Connection*> connections;
-	vector<sc2::Server*> servers;
-
-	uint64_t kill_procs() {
-		uint64_t res = 0;
-		for (uint64_t pid : pids)
-			if (!kill_proc(pid))
-				res = pid;
-
-		return res;
-	};
-
-	void sig_handler() {
-		uint64_t res = kill_procs();
-		if (res != 0)
-			cout << "Failed to kill some subprocess " << res << endl;
-		else
-			cout << "Killed all subprocesses" << endl;
-
-		exit(1);
-	};
-
-	void init(vector<Bot> bots, vector<string> maps) {
-		Arena::bots = bots;
-		num_players = bots.size();
-		Arena::maps = maps;
-		num_maps = maps.size();
-
-		register_handler(&sig_handler);
-	};
-
-	void resolve_map(SC2APIProtocol::RequestCreateGame* request, string map_name, string proc_path) {
-		// BattleNet map
-		if (!sc2::HasExtension(map_name, ".SC2Map")) {
-			request->set_battlenet_map_name(map_name);
-			return;
-		}
-
-		// Absolute path
-		SC2APIProtocol::LocalMap* local_map = request->mutable_local_map();
-		if (sc2::DoesFileExist(map_name)) {
-			local_map->set_map_path(map_name);
-			return;
-		}
-
-		// Relative path - Game maps directory
-		string game_relative = sc2::GetGameMapsDirectory(proc_path) + map_name;
-		if (sc2::DoesFileExist(game_relative)) {
-			local_map->set_map_path(map_name);
-			return;
-		}
-
-		// Relative path - Library maps directory
-		string library_relative = sc2::GetLibraryMapsDirectory() + map_name;
-		if (sc2::DoesFileExist(library_relative)) {
-			local_map->set_map_path(library_relative);
-			return;
-		}
-
-		// Relative path - Remotely saved maps directory
-		local_map->set_map_path(map_name);
-	};
-	void start_sc2(int port, int argc, char* argv[]) {
-		// 1) Launch two game instances with separate ports.
-		// Setup sc2api websocket server
-		for (int i = 0; i < num_players; i++) {
-			sc2::Server* s = new sc2::Server();
-			servers.push_back(s);
-			cout << "Player " << i << ", port:" << port << endl;
-			s->Listen(to_string(port++).c_str(), REQUEST_TIMEOUT, REQUEST_TIMEOUT, GAME_THREADS);
-		}
-
-		cout << "Starting " << num_players << " instances of sc2 "
-			<< "(timeout " << GAME_TIMEOUT << ")..." << endl;
-		sc2::ParseSettings(argc, argv, process_settings, game_settings);
-		for (int i = 0; i < num_players; i++) {
-			pids.push_back(sc2::StartProcess(process_settings.process_path, {
-				"-listen", BOT_HOST,
-				"-port", to_string(port++).c_str(),
-				"-displayMode", "0",
-				"-dataVersion", process_settings.data_version }));
-			cout << "Starting SC2, PID:" << pids.back()
-				<< ", port:" << port << endl;
-		}
-
-		// Give game 10 sec to start
-		sc2::SleepFor(GAME_TIMEOUT);
-	};
-	void connect_players(int port, string first_map, string proc_path) {
-		// Connect to localhost websocket
-		for (int i = 0; i < num_players; i++) {
-			cout << "Player " << i << ", connecting port:" << port << endl;
-			connections.push_back(new sc2::Connection());
-			connections.back()->Connect(BOT_HOST, port++, false);
-		}
-
-		// 2) Designate a host, and Request.create_game with a multiplayer map.
-		sc2::GameRequestPtr req = proto.MakeRequest();
-		SC2APIProtocol::RequestCreateGame* game_request = req->mutable_create_game();
-		resolve_map(game_request, first_map, proc_path);
-		game_request->set_realtime(false);
-
-		for (auto const &p : bots) {
-			SC2APIProtocol::PlayerSetup* playerSetup = game_request->add_player_setup();
-			playerSetup->set_type(SC2APIProtocol::PlayerType(p.type));
-			playerSetup->set_race(SC2APIProtocol::Race(int(p.race) + 1));
-			playerSetup->set_difficulty(SC2APIProtocol::Difficulty(p.difficulty));
-		}
-
-		connections[0]->Send(req.get());
-		SC2APIProtocol::Response* response_create_game = nullptr;
-		if (connections[0]->Receive(response_create_game, GAME_TIMEOUT)) {
-			auto game_response = response_create_game->create_game();
-			if (game_response.has_error()) {
-				string errorCode = "Unknown";
-				switch (game_response.error()) {
-				case SC2APIProtocol::ResponseCreateGame::MissingMap: errorCode = "Missing Map";
-				case SC2APIProtocol::ResponseCreateGame::InvalidMapPath: errorCode = "Invalid Map Path";
-				case SC2APIProtocol::ResponseCreateGame::InvalidMapData: errorCode = "Invalid Map Data";
-				case SC2APIProtocol::ResponseCreateGame::InvalidMapName: errorCode = "Invalid Map Name";
-				case SC2APIProtocol::ResponseCreateGame::InvalidMapHandle: errorCode = "Invalid Map Handle";
-				case SC2APIProtocol::ResponseCreateGame::MissingPlayerSetup: errorCode = "Missing Player Setup";
-				case SC2APIProtocol::ResponseCreateGame::InvalidPlayerSetup: errorCode = "Invalid Player Setup";
-				}
-
-				cerr << "CreateGame request returned an error code: " << errorCode << endl;
-				if (game_response.has_error_details() && game_response.error_details().length() > 0) {
-					cerr << "CreateGame request returned error details: " << game_response.error_details() << endl;
-				}
-				exit(-1);
-			}
-			else {
-				cout << "Recieved create game response " << response_create_game->data().DebugString() << endl;
-			}
-		}
-		// 3) Call Request.join on BOTH clients.Join will block until both clients connect.
-		// The client take over from here and do coordinator.JoinGame(); themselves
-	};
-	ClientStatus client_tick(sc2::Connection* client, sc2::Server* server) {
-		ClientStatus client_status = ClientStatus::Running;
-		clock_t last_request = clock();
-
-		while (client_status == ClientStatus::Running) {
-			if (client->connection_ == nullptr) {
-				cout << "Client disconnect" << endl;
-				client_status = ClientStatus::ClientTimeout;
-			}
-
-			if (server->HasRequest()) {
-				if (server->PeekRequest().second->has_quit())
-					// Intercept leave game and quit requests, we want to keep game alive to save replays
-					return ClientStatus::Quit;
-
-				server->SendRequest(client->connection_);
-				SC2APIProtocol::Response* response = nullptr;
-				client->Receive(response, 100000);
-				if (response != nullptr) {
-					if (response->status() > SC2APIProtocol::Status::in_replay) {
-						client_status = ClientStatus::GameEnd;
-					}
-					if (response->has_observation()) {
-						const auto obs = response->observation().observation();
-						if (obs.game_loop() > ARENA_GAME_TIMEOUT)
-							client_status = ClientStatus::GameTimeout;
-					}
-				}
-				if (server->connections_.size() > 0) {
-					// Send the response back to the client.
-					server->QueueResponse(client->connection_, response);
-					server->SendResponse();
-				}
-				else {
-					cout << "Clients all disconnected" << endl;
-					client_status = ClientStatus::ClientTimeout;
-				}
-
-				last_request = clock();
-			}
-			else if ((last_request + (10 * CLOCKS_PER_SEC)) < clock()) {
-				cout << "Client timeout" << endl;
-				client_status = ClientStatus::ClientTimeout;
-			}
-		}
-		return client_status;
-	}
-
-	int get_results(sc2::Connection* con) {
-		return 0;
-	}
-	int run_bot_bins() {
-		// 4) Wait for a response from both clients.They can now play / step.
-		int res = ArenaResult::None;
-		vector<future<ClientStatus>> threads_tick(num_players);
-
-		// Start each bot's binary as a subprocess
-		for (auto const &b : bots) {
-			pids.push_back(start_proc(b.path, b.cmd_args));
-			cout << "Starting " << b.name << " PID:" << pids.back() << endl;
-		}
-
-		// For each bot make a thread to handle the connection
-		for (int i = 0; i < num_players; i++) {
-			threads_tick[i] = async(&client_tick, connections[i], servers[i]);
-		}
-
-		cout << "Giving bots 3s to join..." << endl;
-		this_thread::sleep_for(chrono::nanoseconds(3s));
-		cout << "Starting game" << endl;
-
-		vector<future_status> statuses_tick(num_players);
-		// Run them until game ends.
-		while (true) {
-			// FIX THREADING HERE
-			// Wait for first thread
-			statuses_tick[0] = threads_tick[0].wait_for(500ms);
-			// Get status of the rest
-			for (unsigned int i = 1; i < threads_tick.size(); i++) {
-				statuses_tick[i] = threads_tick[i].wait_for(0s);
-			}
-
-			for (unsigned int i = 0; i < statuses_tick.size(); i++) {
-				if (statuses_tick[i] == future_status::ready) {
-					cout << "bot " << bots[i].name << " done" << endl;
-					ClientStatus cs = threads_tick[i].get();
-					switch (cs) {
-					case ClientStatus::ClientTimeout:	res = res | (Player1Crash + (1u << i));
-					case ClientStatus::Quit:			res = res | (Player1Forfeit + (1u << i));
-					case ClientStatus::GameTimeout:		res = res | GameTimeout;
-					}
-				}
-			}
-
-		}
-		// Get who won
-		res = res | get_results(connections[0]);
-
-		// Cleanup
-
-		return res;
-	};
-
-	int play(string map, int argc, char *argv[]) {
-		// Follow the instructions...
-		// https://github.com/Blizzard/s2client-proto/blob/master/s2clientprotocol/sc2api.proto
-
-		start_sc2(PORT_P1, argc, argv);
-		connect_players(int(PORT_P1 + bots.size()), map, process_settings.process_path);
+	vector<ResourceGroup*> groups;
+	// The slice the bots' groups are under. sc2 instances outlive the
+	// match, and a group cannot move, so theirs stay outside it.
+	ResourceGroup* group = nullptr;
+	vector<Sc2Instance*> instances;
+	vector<BotServer*> servers;
+	// sc2 usage when the match got the instances
+	vector<ResourceUsage> sc2_baseline;
+	// The relays' states while the bots play, for the metrics endpoint.
+	// Set and cleared under Arena::running_lock.
+	const vector<RelayState>* states = nullptr;
+
+	// Filled in by Arena::play
+	MatchRecord record;
+	// Tags the match's log events, set once its ports are leased
+	LogContext log;
+};
 
-		return run_bot_bins();
-	};
+namespace Arena {
+	extern vector<Bot> bots;
+	extern size_t num_players;
+	extern vector<string> maps;
+	extern size_t num_maps;
+
+	extern sc2::ProtoInterface proto;
+	extern sc2::ProcessSettings process_settings;
+	extern sc2::GameSettings game_settings;
+
+	// Port blocks of running matches and sc2 instances' ports
+	extern PortAllocator* ports;
+	extern Sc2Pool* pool;
+	// Runs the relays of every match
+	extern RelayExecutor* executor;
+	// Where finished games' replays go, none are saved if null
+	extern ReplayArchive* archive;
+	// The configured maps, resolved at init
+	extern MapCatalog* catalog;
+
+	// Matches currently being played, for the signal handler and metrics
+	extern vector<Match*> running;
+	extern mutex running_lock;
+
+	// Live state of every running match in the Prometheus text format
+	void write_metrics(ostream& out);
+
+	uint64_t kill_procs();
+	// Kills everything and exits. Runs on the thread register_handler
+	// started, never in signal context.
+	void sig_handler();
+	// Takes in the config, nothing is started. argv holds the sc2
+	// options, config overrides them.
+	void configure(const ArenaConfig& config, int argc, char* argv[]);
+	// Starts the port allocator, sc2 pool, relay executor and map
+	// catalog for a configured and validated arena
+	void init();
+	// Stops the relay executor and the sc2 pool, no match may be running
+	// unless the process is about to exit
+	void shutdown();
+	// Where a .SC2Map is on disk, "" if it is not in any place sc2 looks
+	string map_file(string map_name, string proc_path);
+	// False if the map is not found locally and is left for sc2 to look
+	// for among remotely saved maps
+	bool resolve_map(SC2APIProtocol::RequestCreateGame* request, string map_name, string proc_path);
+
+	// Port layout of a match block: one relay port per bot, then the
+	// 1 + 2n ports bots use for the multiplayer game.
+	size_t match_ports(size_t players);
+	int bot_port(const Match& match, size_t player);
+	int game_port_start(const Match& match);
+	// Command line for a player's bot, pointed at the match's ports
+	vector<string> make_args(const Match& match, size_t player);
+
+	bool start_sc2(Match& match);
+	bool connect_players(Match& match);
+	int run_bot_bins(Match& match);
+	bool save_replay(Match& match);
+	// Reads what the bots and instances used into match.record, before
+	// teardown kills them
+	void record_usage(Match& match);
+	void teardown(Match& match);
+	int play(Match& match);
 };
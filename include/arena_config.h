@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <arena_settings.h>
+#include <arena_types.h>
+#include <tournament.h>
+
+using namespace std;
+
+// Everything a run of the arena is told: who plays, where, how the
+// matches are arranged and the settings they are played under.
+//
+// Config files are lines of "key = value", with # at the start of a line
+// or after whitespace starting a comment.
+// Each [bot] line starts a new bot, whose keys follow it. See README.md
+// for the keys.
+struct ArenaConfig {
+	// sc2 binary, "" to find it the way the s2client-api examples do
+	string sc2_path;
+	// Passed to every sc2 instance, for example mock_sc2's options
+	vector<string> sc2_args;
+
+	vector<Bot> bots;
+	vector<string> maps;
+	TournamentType tournament = TournamentType::RoundRobin;
+	// Matches played at once, 0 sizes to the host
+	int concurrency = 0;
+
+	// Outputs, "" disables each
+	string results_path = "results.db";
+	string replay_dir = "replays";
+	string checkpoint_path = "tournament.checkpoint";
+
+	ArenaSettings settings;
+};
+
+// Reads path into config. Problems are added to errors, with their line.
+bool load_config(const string& path, ArenaConfig& config, vector<string>& errors);
+// Sets one top level key, as a config file line or --set would.
+bool set_option(ArenaConfig& config, const string& key, const string& value, string& error);
+// Everything that would stop the run part way: missing bot binaries,
+// maps sc2 could not find, impossible limits. Needs Arena::configure to
+// have found sc2, and runs before Arena::init starts anything.
+vector<string> validate_config(const ArenaConfig& config);
@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+using namespace std;
+
+// Events queued before the flusher falls behind and new ones are dropped
+#define LOG_RING_SIZE 8192
+// How long the flusher sleeps once it has written everything queued
+#define LOG_FLUSH_MS 10
+
+enum LogLevel {
+	LogDebug,
+	LogInfo,
+	LogWarn,
+	LogError,
+	LogOff
+};
+
+enum LogFormat {
+	// One JSON object per line
+	LogJson,
+	// level, match and bot in front of the message, for reading on a console
+	LogText
+};
+
+// Who an event is about, empty fields are left out
+struct LogContext {
+	string match;
+	string bot;
+};
+
+// The arena's own log. Threads queue events on a lock-free ring and a
+// background thread formats and writes them, so logging from a relay
+// never waits on the console or a file and lines from concurrent
+// matches never interleave. Below the level nothing is even formatted:
+// the ARENA_LOG macros check it with one relaxed load first.
+class ArenaLog {
+public:
+	// Lives until the process exits, main flushes it before returning
+	static ArenaLog& instance();
+
+	static bool enabled(LogLevel level) { return int(level) >= threshold.load(memory_order_relaxed); }
+	static void set_level(LogLevel level) { threshold.store(int(level), memory_order_relaxed); }
+	static bool parse_level(const string& name, LogLevel& level);
+	static bool parse_format(const string& name, LogFormat& format);
+
+	// Appends to the file at path from now on, stdout if path is "".
+	// False if it cannot be opened, the log then stays where it was.
+	bool open(const string& path, LogFormat format);
+	// Queues an event, never blocks. Dropped if the ring is full.
+	void write(LogLevel level, const LogContext* context, string& message);
+	// Returns once everything queued so far has been written out
+	void flush();
+	// Events lost to a full ring
+	uint64_t dropped() const { return lost.load(memory_order_relaxed); }
+
+private:
+	ArenaLog();
+	void run();
+	// Writes out every event that is ready, false if there was none
+	bool drain();
+	void format(LogLevel level, int64_t time_us, const string& match, const string& bot, const string& message);
+
+	struct Slot {
+		atomic<size_t> sequence;
+		LogLevel level;
+		// Since the unix epoch
+		int64_t time_us;
+		string match;
+		string bot;
+		string message;
+	};
+
+	static atomic<int> threshold;
+
+	unique_ptr<Slot[]> slots;
+	atomic<size_t> tail{ 0 };
+	// Only the flusher moves head, and publishes it as done once the
+	// event is written
+	size_t head = 0;
+	atomic<size_t> done{ 0 };
+	atomic<uint64_t> lost{ 0 };
+
+	// Held while writing a batch, and to switch the output
+	mutex sink_lock;
+	FILE* sink = stdout;
+	LogFormat style = LogJson;
+	string line;
+};
+
+#define ARENA_LOG(level, context, ...) do { \
+	if (ArenaLog::enabled(level)) { \
+		ostringstream arena_log_stream; \
+		arena_log_stream << __VA_ARGS__; \
+		string arena_log_message = arena_log_stream.str(); \
+		ArenaLog::instance().write(level, context, arena_log_message); \
+	} \
+} while (0)
+
+#define LOG_DEBUG(context, ...) ARENA_LOG(LogDebug, context, __VA_ARGS__)
+#define LOG_INFO(context, ...) ARENA_LOG(LogInfo, context, __VA_ARGS__)
+#define LOG_WARN(context, ...) ARENA_LOG(LogWarn, context, __VA_ARGS__)
+#define LOG_ERROR(context, ...) ARENA_LOG(LogError, context, __VA_ARGS__)
@@ -2,21 +2,47 @@
 #include <vector>
 #include <string>
 #include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <arena_log.h>
 // Process manip headers
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
 
 #elif defined(__APPLE__) || defined(__linux__)
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
-#inlcude <process.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sched.h>
+#else
+#include <spawn.h>
+#endif
 #else
 #error "Unsupported platform"
 #endif
 
 // https://github.com/Blizzard/s2client-api/blob/master/src/sc2utils/sc2_manage_process.cc
+// cgroup is the directory of a cgroup v2 group to start the process in,
+// only used on Linux. output, if not -1, becomes the process's stdout and
+// stderr and is closed once the process has it; otherwise the process
+// shares the arena's. pidfd, if given, is set to a pidfd for the process
+// where the kernel supports them and -1 elsewhere.
+// Returns 0 if no process could be started.
 #ifdef _WIN32
-uint64_t start_proc(std::string cmd, std::vector<std::string> args) {
+inline uint64_t start_proc(std::string cmd, std::vector<std::string> args, const std::string& cgroup = "",
+	int output = -1, int* pidfd = nullptr) {
+	if (pidfd != nullptr)
+		*pidfd = -1;
+
 	PROCESS_INFORMATION pi = { 0 };
 	STARTUPINFO si = { 0 };
 	si.cb = sizeof(si);
@@ -41,14 +67,14 @@ uint64_t start_proc(std::string cmd, std::vector<std::string> args) {
 					   &pi)											// Pointer to PROCESS_INFORMATION structure
 		)
 	{
-		std::cerr << "Failed to execute process " << cmd << std::endl;
+		LOG_ERROR(nullptr, "Failed to execute process " << cmd);
 		return uint64_t(0);
 	}
 
 	return static_cast<uint64_t>(pi.dwProcessId);
 }
 
-bool kill_proc(uint64_t process_id) {
+inline bool kill_proc(uint64_t process_id) {
 	HANDLE hProcess = OpenProcess(PROCESS_TERMINATE, false, (DWORD)process_id);
 	if (hProcess == NULL) {
 		return false;
@@ -60,52 +86,293 @@ bool kill_proc(uint64_t process_id) {
 	return result;
 }
 
-bool register_handler(void* handler) {
+inline bool register_handler(void* handler) {
 	return SetConsoleCtrlHandler((PHANDLER_ROUTINE)handler, true);
 }
+
+inline bool proc_exited(uint64_t process_id) {
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, false, (DWORD)process_id);
+	if (hProcess == NULL) {
+		return true;
+	}
+
+	bool result = WaitForSingleObject(hProcess, 0) == WAIT_OBJECT_0;
+	CloseHandle(hProcess);
+
+	return result;
+}
+
+// Windows keeps no zombies to collect
+inline void reap_proc(uint64_t process_id) {
+}
+
+// True if the directory exists afterwards
+inline bool make_dir(const std::string& path) {
+	return CreateDirectoryA(path.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+inline uint64_t physical_memory_mb() {
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status))
+		return 0;
+
+	return status.ullTotalPhys / (1024 * 1024);
+}
+
+// CPU time and peak memory of a process that is still around.
+inline bool proc_usage(uint64_t process_id, uint64_t& cpu_ms, uint64_t& peak_rss_kb) {
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, (DWORD)process_id);
+	if (hProcess == NULL) {
+		return false;
+	}
+
+	FILETIME creation, exit, kernel, user;
+	PROCESS_MEMORY_COUNTERS counters;
+	bool result = GetProcessTimes(hProcess, &creation, &exit, &kernel, &user)
+		&& GetProcessMemoryInfo(hProcess, &counters, sizeof(counters));
+	CloseHandle(hProcess);
+	if (!result)
+		return false;
+
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	cpu_ms = (k.QuadPart + u.QuadPart) / 10000;
+	peak_rss_kb = counters.PeakWorkingSetSize / 1024;
+	return true;
+}
 #elif defined(__linux__) || defined(__APPLE__)
-uint64_t start_proc(string cmd, vector<string> args) {
+#ifdef __linux__
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+struct SpawnArgs {
+	char* const* argv;
+	int cgroup_procs;
+	int output;
+	const sigset_t* mask;
+	// Set by the child if it did not get as far as exec
+	int error;
+};
+
+// Runs in the child on its own small stack, sharing the arena's memory
+// until it execs, so it may only make system calls.
+inline int spawn_child(void* arg) {
+	SpawnArgs* a = static_cast<SpawnArgs*>(arg);
+	// Handlers point into the arena, put them back to default before the
+	// signals the parent blocked are let through
+	struct sigaction action;
+	for (int s = 1; s < NSIG; s++) {
+		if (sigaction(s, nullptr, &action) != 0 || action.sa_handler == SIG_DFL || action.sa_handler == SIG_IGN)
+			continue;
+		action.sa_handler = SIG_DFL;
+		action.sa_flags = 0;
+		sigaction(s, &action, nullptr);
+	}
+	sigprocmask(SIG_SETMASK, a->mask, nullptr);
+
+	// Join the group before exec, so nothing the process does escapes it
+	if (a->cgroup_procs >= 0 && write(a->cgroup_procs, "0", 1) != 1) {
+		a->error = errno;
+		_exit(127);
+	}
+	if (a->output >= 0 && (dup2(a->output, STDOUT_FILENO) < 0 || dup2(a->output, STDERR_FILENO) < 0)) {
+		a->error = errno;
+		_exit(127);
+	}
+
+	execve(a->argv[0], a->argv, nullptr);
+	a->error = errno;
+	_exit(127);
+}
+#endif
+
+inline uint64_t start_proc(std::string cmd, std::vector<std::string> args, const std::string& cgroup = "",
+	int output = -1, int* pidfd = nullptr) {
 	std::vector<char*> char_list;
 	// execve expects the process path to be the first argument in the list.
-	char_list.push_back(const_cast<char*>(args.c_str()));
+	char_list.push_back(const_cast<char*>(cmd.c_str()));
 	for (auto& s : args) {
 		char_list.push_back(const_cast<char*>(s.c_str()));
 	}
 
 	// List needs to be null terminated for execve.
 	char_list.push_back(nullptr);
+	if (pidfd != nullptr)
+		*pidfd = -1;
 
-	// Start the process.
-	pid_t p = fork();
-	if (p == 0) {
-		if (execve(char_list[0], &char_list[0], nullptr) == -1) {
-			std::cerr << "Failed to execute process " << char_list[0]
-				<< " error: " << strerror(errno) << std::endl;
-			exit(-1);
-		}
+	pid_t p;
+#ifdef __linux__
+	// A vfork style clone shares the arena's memory instead of copying its
+	// page tables, so starting a bot costs the same however big the arena
+	// has grown. The arena is suspended until the child execs.
+	int cgroup_procs = -1;
+	if (!cgroup.empty()) {
+		cgroup_procs = open((cgroup + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+		if (cgroup_procs == -1)
+			LOG_ERROR(nullptr, "Could not join cgroup " << cgroup << ": " << strerror(errno));
 	}
 
+	std::vector<char> stack(SPAWN_STACK_SIZE);
+	void* stack_top = reinterpret_cast<void*>(uintptr_t(stack.data() + stack.size()) & ~uintptr_t(15));
+	sigset_t all, mask;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &mask);
+	// The arena's own mask blocks SIGINT for its signal thread, the child
+	// starts with nothing blocked
+	sigset_t child_mask;
+	sigemptyset(&child_mask);
+	SpawnArgs spawn_args = { &char_list[0], cgroup_procs, output, &child_mask, 0 };
+	int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+	int fd = -1;
+	p = clone(spawn_child, stack_top, flags | (pidfd != nullptr ? CLONE_PIDFD : 0), &spawn_args, &fd);
+	// Kernels before 5.2 have no CLONE_PIDFD
+	if (p == -1 && pidfd != nullptr && errno == EINVAL) {
+		fd = -1;
+		p = clone(spawn_child, stack_top, flags, &spawn_args);
+	}
+	pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+	if (cgroup_procs != -1)
+		close(cgroup_procs);
+	if (p != -1 && pidfd != nullptr)
+		*pidfd = fd;
+	int error = p == -1 ? errno : spawn_args.error;
+#else
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (output >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, output, STDERR_FILENO);
+	}
+	// Not the arena's mask, which blocks SIGINT for its signal thread
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	sigset_t child_mask;
+	sigemptyset(&child_mask);
+	posix_spawnattr_setsigmask(&attributes, &child_mask);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+	int error = posix_spawn(&p, char_list[0], &actions, &attributes, &char_list[0], nullptr);
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&actions);
+	if (error != 0)
+		p = -1;
+#endif
+	if (output >= 0)
+		close(output);
+
+	if (p == -1) {
+		LOG_ERROR(nullptr, "Failed to start process " << cmd << " error: " << strerror(error));
+		return 0;
+	}
+	// The child has exited already, it is left for the caller to reap
+	if (error != 0)
+		LOG_ERROR(nullptr, "Failed to execute process " << cmd << " error: " << strerror(error));
+
 	return p;
 }
 
-bool kill_proc(uint64_t process_id) {
-	if (kill(process_id, SIGKILL) == -1) {
+inline bool kill_proc(uint64_t process_id) {
+	// kill(0) would hit the arena's whole process group
+	if (process_id == 0 || kill(process_id, SIGKILL) == -1) {
 		return false;
 	}
 	return true;
 }
 
-bool register_handler(void* handler) {
-	struct sigaction sigIntHandler;
+// True once the process has exited. kill(pid, 0) still succeeds on a
+// child that exited but was not reaped yet, this does not.
+inline bool proc_exited(uint64_t process_id) {
+	// Never started
+	if (process_id == 0)
+		return true;
+
+	siginfo_t info;
+	std::memset(&info, 0, sizeof(info));
+	// WNOWAIT leaves the child to be reaped by reap_proc
+	if (waitid(P_PID, (id_t)process_id, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+		// Not our child
+		return kill(process_id, 0) == -1 && errno == ESRCH;
+	}
+
+	return info.si_pid != 0;
+}
 
-	sigIntHandler.sa_handler = handler;
-	sigemptyset(&sigIntHandler.sa_mask);
-	sigIntHandler.sa_flags = 0;
+// Collects an exited or killed child so it does not linger as a zombie.
+inline void reap_proc(uint64_t process_id) {
+	if (process_id != 0)
+		waitpid((pid_t)process_id, nullptr, 0);
+}
 
-	if (sigaction(SIGINT, &sigIntHandler, NULL) == -1) {
+// True if the directory exists afterwards
+inline bool make_dir(const std::string& path) {
+	return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// SIGINT is blocked in the calling thread and every thread started after
+// it, and handler runs on a thread of its own once one arrives, where it
+// may take locks and join threads like any other code. Call before any
+// other thread is started, or that thread still takes SIGINT and dies
+// of it.
+inline bool register_handler(void* handler) {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	if (pthread_sigmask(SIG_BLOCK, &set, nullptr) != 0)
 		return false;
-	}
+
+	std::thread([set, handler]() {
+		int signal;
+		if (sigwait(&set, &signal) == 0)
+			((void (*)(int))handler)(signal);
+	}).detach();
+
+	return true;
+}
+
+inline uint64_t physical_memory_mb() {
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long page_size = sysconf(_SC_PAGE_SIZE);
+	if (pages < 0 || page_size < 0)
+		return 0;
+
+	return uint64_t(pages) * uint64_t(page_size) / (1024 * 1024);
+}
+
+// CPU time and peak memory of a process that has not been reaped yet.
+// Reads /proc, so it only knows anything on Linux.
+inline bool proc_usage(uint64_t process_id, uint64_t& cpu_ms, uint64_t& peak_rss_kb) {
+	std::string proc = "/proc/" + std::to_string(process_id);
+	std::ifstream stat(proc + "/stat");
+	std::string line;
+	if (!std::getline(stat, line))
+		return false;
+
+	// The command name may contain spaces, count fields from the state
+	// after it
+	size_t name_end = line.rfind(')');
+	if (name_end == std::string::npos)
+		return false;
+	std::istringstream fields(line.substr(name_end + 1));
+	std::string skip;
+	for (int field = 3; field < 14; field++)
+		fields >> skip;
+	uint64_t utime = 0, stime = 0, cutime = 0, cstime = 0;
+	fields >> utime >> stime >> cutime >> cstime;
+	long ticks = sysconf(_SC_CLK_TCK);
+	cpu_ms = ticks > 0 ? (utime + stime + cutime + cstime) * 1000 / uint64_t(ticks) : 0;
+
+	// Gone once the process is a zombie
+	peak_rss_kb = 0;
+	std::ifstream status(proc + "/status");
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			peak_rss_kb = std::strtoull(line.c_str() + 6, nullptr, 10);
 
 	return true;
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdlib>
+#include <string>
+#include <arena_types.h>
+
+using namespace std;
+
+// Limits and outputs the arena reads at run time. The macros in
+// arena_types.h are the defaults; a config file or --set changes them,
+// see arena_config.h.
+struct ArenaSettings {
+	// Timeouts, ms
+	int request_timeout_ms = atoi(REQUEST_TIMEOUT);
+	int game_timeout_ms = GAME_TIMEOUT;
+	int bot_timeout_ms = BOT_TIMEOUT;
+	int join_timeout_ms = BOT_JOIN_TIMEOUT;
+	int sc2_start_timeout_ms = SC2_START_TIMEOUT;
+	int match_timeout_ms = MATCH_TIMEOUT;
+	int bot_exit_grace_ms = BOT_EXIT_GRACE;
+	int max_game_loops = ARENA_GAME_TIMEOUT;
+	// Default compute budget of bots that do not set their own
+	int step_limit_ms = STEP_TIME_LIMIT;
+	int time_bank_ms = TIME_BANK;
+
+	// Concurrency
+	int game_threads = atoi(GAME_THREADS);
+	int relay_threads = RELAY_THREADS;
+	int port_first = PORT_FIRST;
+	int port_last = PORT_LAST;
+	int sc2_pool_size = SC2_POOL_SIZE;
+	int sc2_max_games = SC2_MAX_GAMES;
+	int sc2_memory_mb = SC2_MEMORY_MB;
+	bool lockstep = LOCKSTEP;
+	bool realtime = REALTIME;
+
+	// Resource limits
+	string cgroup_root = CGROUP_ROOT;
+	int bot_cpu_percent = BOT_CPU_PERCENT;
+	int bot_memory_mb = BOT_MEMORY_MB;
+	int sc2_cpu_percent = SC2_CPU_PERCENT;
+	int sc2_memory_limit_mb = SC2_MEMORY_LIMIT_MB;
+	bool pin_cpus = PIN_CPUS;
+
+	// Maps
+	string map_delivery = MAP_DELIVERY;
+	string map_stage_dir = MAP_STAGE_DIR;
+
+	// Outputs, "" disables each
+	string log_dir = BOT_LOG_DIR;
+	int log_rotate_bytes = LOG_ROTATE_BYTES;
+	int log_rotate_keep = LOG_ROTATE_KEEP;
+	string trace_prefix = TRACE_PREFIX;
+	string latency_series_prefix = LATENCY_SERIES_PREFIX;
+	int metrics_port = METRICS_PORT;
+	string log_level = LOG_LEVEL;
+	string log_format = LOG_FORMAT;
+	string log_file = LOG_FILE;
+};
+
+// The running arena's settings, fixed once matches start
+extern ArenaSettings settings;
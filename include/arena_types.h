@@ -1,18 +1,58 @@
 #pragma once
 #define BOT_HOST "127.0.0.1"
-#define PORT_P1 5677
-#define PORT_GAME_START 5690
+#define PORT_FIRST 5677 // matches and sc2 instances lease their ports from PORT_FIRST..PORT_LAST
+#define PORT_LAST 32767 // stays below the usual ephemeral range
 #define REQUEST_TIMEOUT "2000" // ms
 #define GAME_TIMEOUT 10000 // ms
-#define ARENA_GAME_TIMEOUT 20*60*60 // ms 
-#define GAME_THREADS "4"
+#define BOT_TIMEOUT 50000 // ms
+#define BOT_JOIN_TIMEOUT 30000 // ms, from launching the bots to all of them joining
+#define SC2_START_TIMEOUT 30000 // ms, from launching sc2 to it answering a ping
+#define MATCH_TIMEOUT (2*60*60*1000) // ms of wall time from launching the bots to the match being called a timeout
+#define BOT_EXIT_GRACE 1000 // ms a relay gets to report the game's end once its bot has exited
+#define ARENA_GAME_TIMEOUT (20*60*60) // game loops before a game is called a timeout
+#define GAME_THREADS "2" // civetweb threads per bot server, one bot connects to each
+#define RELAY_THREADS 0 // relay executor threads, 0 for one per core
+#define MAX_PLAYERS 8
+#define SC2_MEMORY_MB 2048 // per instance, for sizing parallel matches
+#define CGROUP_ROOT "/sys/fs/cgroup/sc2arena" // cgroup v2 group that each sc2 instance and each match's slice of bot groups go under, "" to disable
+#define BOT_CPU_PERCENT 100 // of one core, per bot, 0 for no quota
+#define BOT_MEMORY_MB 4096 // per bot and everything it starts, 0 for no cap
+#define SC2_CPU_PERCENT 100 // of one core, per sc2 instance, 0 for no quota
+#define SC2_MEMORY_LIMIT_MB 4096 // per sc2 instance, 0 for no cap
+#define PIN_CPUS 1 // pin each bot and sc2 instance to the least used core
+#define SC2_POOL_SIZE 256 // most sc2 instances alive at once
+#define SC2_MAX_GAMES 50 // games an instance hosts before it is relaunched
+#define STEP_TIME_LIMIT 1000 // ms a bot may think per request before drawing on its time bank, 0 for none
+#define TIME_BANK 30000 // ms of overrun a bot may use over a whole game before it forfeits
+#define BOT_LOG_DIR "logs" // each match's bot output goes to a directory in here, "" to leave it on the arena's console
+#define LOG_ROTATE_BYTES (16 * 1024 * 1024) // size a bot log grows to before it is moved aside
+#define LOG_ROTATE_KEEP 2 // older bot logs kept per bot
+#define MAP_DELIVERY "path" // how create_game gets a local map to sc2: "path", "inline" bytes, or "stage" a copy in MAP_STAGE_DIR
+#define MAP_STAGE_DIR "/dev/shm/sc2arena-maps" // where "stage" copies maps, best on a tmpfs
+#define TRACE_PREFIX "" // per player traces of every relayed message, "" to disable
+#define LATENCY_SERIES_PREFIX "latency_" // per match step time series, "" to disable
+#define LOCKSTEP 0 // hold each player's step until every player has sent one, then step all sc2 instances together
+#define REALTIME 0 // play matches in realtime, sc2 running at Faster speed without waiting for the bots
+#define METRICS_PORT 0 // local port serving /metrics for Prometheus, 0 to disable
+#define LOG_LEVEL "info" // least severe arena log events written: debug, info, warn, error or off
+#define LOG_FORMAT "json" // arena log lines as "json" objects or plain "text"
+#define LOG_FILE "" // file the arena log is appended to, "" for stdout
 
 #include <sc2api/sc2_game_settings.h>
 #include <sc2api/sc2_server.h>
+#include <atomic>
 #include <string> 
+#include <chrono>
+#include <vector>
+#include <time.h>
+#include <arena_log.h>
+#include <relay_metrics.h>
 
 using namespace std;
 
+class TraceWriter;
+class StepBarrier;
+
 struct Bot : sc2::PlayerSetup {
 	string name;
 	string path;
@@ -20,6 +60,9 @@ struct Bot : sc2::PlayerSetup {
 	sc2::Race race;
 	sc2::Difficulty difficulty;
 	int seed;
+	// Compute budget, -1 for the arena's step_limit_ms and time_bank_ms
+	int step_limit_ms = -1;
+	int time_bank_ms = -1;
 };
 
 enum ClientStatus {
@@ -27,8 +70,49 @@ enum ClientStatus {
 	GameTimeout,
 	ClientTimeout,
 	Quit,
+	// Overran its step limit with the time bank empty
+	OutOfTime,
+	// sc2 stopped answering, the arena's fault rather than the bot's
+	GameError,
 	Running
 };
+// What a relay saw of its player's game.
+struct RelayState {
+	RelayMetrics metrics;
+	// Think time allowed per request, 0 for no limit, and what is left
+	// of the bank that overruns are drawn from
+	chrono::milliseconds step_limit{ 0 };
+	chrono::milliseconds time_bank{ 0 };
+	uint64_t overruns = 0;
+	// How long the bot may take to send a request, and sc2 to answer one.
+	// join_game is only answered once everyone joined, it gets longer.
+	chrono::milliseconds bot_timeout{ BOT_TIMEOUT };
+	chrono::milliseconds game_timeout{ GAME_TIMEOUT };
+	chrono::milliseconds join_timeout{ BOT_JOIN_TIMEOUT };
+	// Game loop past which the game is called a timeout
+	uint32_t max_game_loops = ARENA_GAME_TIMEOUT;
+	// Records every message passed on, if set
+	TraceWriter* trace = nullptr;
+	// Steps wait here for the other players' when the match is played in
+	// lockstep, as this player's seat
+	StepBarrier* lockstep = nullptr;
+	size_t seat = 0;
+	// Match and bot the relay's log events are about
+	LogContext log;
+	// In a realtime game, how the bot keeps up with it
+	bool realtime = false;
+	RealtimeMetrics pacing;
+	// sc2's id for the player, from the join_game response
+	uint32_t player_id = 0;
+	// Read live by the metrics endpoint
+	atomic<uint32_t> game_loop{ 0 };
+	// How long sc2 took to answer join_game
+	chrono::nanoseconds join_time{ 0 };
+	// Last player_result sc2 sent, SC2APIProtocol::Result by player id
+	bool has_results = false;
+	int results[MAX_PLAYERS + 1] = {};
+};
+
 enum ArenaResult {
 	None = 0,
 	Error = (1u << 0),
@@ -59,6 +143,67 @@ enum ArenaResult {
 	Timeout = (1u << 25),
 };
 
+// How a match went for one player, derived from the ArenaResult bits.
+enum PlayerOutcome {
+	Win,
+	Loss,
+	Draw,
+	Crash,
+	Forfeit,
+	// The match failed on the arena's side, it says nothing about the bot
+	Errored
+};
+
+inline PlayerOutcome player_outcome(int result, size_t player, size_t num_players) {
+	if (result & (ArenaResult::Player1Crash << player))
+		return PlayerOutcome::Crash;
+	if (result & (ArenaResult::Player1Forfeit << player))
+		return PlayerOutcome::Forfeit;
+	if (result & (ArenaResult::Player1Win << player))
+		return PlayerOutcome::Win;
+
+	for (size_t i = 0; i < num_players; i++)
+		if (i != player && (result & (ArenaResult::Player1Win << i)))
+			return PlayerOutcome::Loss;
+	// Nobody won, but someone else dropped out
+	for (size_t i = 0; i < num_players; i++)
+		if (i != player && (result & ((ArenaResult::Player1Crash | ArenaResult::Player1Forfeit) << i)))
+			return PlayerOutcome::Win;
+
+	if (result & ArenaResult::Error)
+		return PlayerOutcome::Errored;
+	return PlayerOutcome::Draw;
+}
+
+// What a process, or a group of them, used over a match
+struct ResourceUsage {
+	uint64_t cpu_ms = 0;
+	uint64_t peak_rss_kb = 0;
+};
+
+// A finished match, as reported and stored.
+struct MatchRecord {
+	string map;
+	// Bot names in seat order
+	vector<string> players;
+	int result = ArenaResult::None;
+	// Winning seat, -1 if nobody won
+	int winner = -1;
+	vector<PlayerOutcome> outcomes;
+	time_t started = 0;
+	uint64_t duration_ms = 0;
+	uint32_t game_loops = 0;
+	// create_game on the host, which loads the map
+	uint64_t map_load_ms = 0;
+	// join_game per seat, each instance loading the map and waiting for
+	// the others
+	vector<uint64_t> join_ms;
+	// Per seat. sc2 instances outlive matches, their CPU time is what the
+	// match used but their peak is over the instance's life.
+	vector<ResourceUsage> bot_usage;
+	vector<ResourceUsage> sc2_usage;
+};
+
 inline ArenaResult operator |(ArenaResult a, ArenaResult b) {
 	return static_cast<ArenaResult>(static_cast<int>(a) | static_cast<int>(b));
 }
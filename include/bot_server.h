@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <s2clientprotocol/sc2api.pb.h>
+#include <message_queue.h>
+
+struct mg_context;
+struct mg_connection;
+
+using namespace std;
+
+// The websocket endpoint a bot connects to thinking it is sc2.
+// sc2::Server can only be polled for requests, which made every relay
+// thread spin. Here an arriving request calls the on_request callback,
+// which queues the relay on the executor, so an idle bot costs nothing.
+// wait_request is for the mock sc2 and the bench, which have a thread
+// to block.
+class BotServer {
+public:
+	~BotServer();
+
+	bool listen(int port, const char* request_timeout, const char* threads);
+	void stop();
+
+	// Blocks until the bot sends a request, disconnects or the timeout
+	// passes. The request is left serialized for the relay to forward.
+	bool wait_request(string& request, chrono::milliseconds timeout);
+	// For relays that do not wait: callback runs whenever a request
+	// arrives or the bot goes away, try_request then takes it.
+	void on_request(function<void()> callback) { requests.listen(callback); }
+	bool try_request(string& request) { return requests.try_pop(request); }
+	// arrived is when the request came in, which may be well before the
+	// relay got to it
+	bool try_request(string& request, chrono::steady_clock::time_point& arrived) { return requests.try_pop(request, arrived); }
+	// The bot is gone and every request it sent has been taken
+	bool drained() { return requests.drained(); }
+	// Requests waiting for the relay
+	size_t queued() const { return requests.size(); }
+	bool send(const string& response);
+	bool send(const SC2APIProtocol::Response& response);
+	bool connected();
+	// Blocks until the bot has sent join_game. Returns right away once
+	// it has, false on timeout.
+	bool wait_joined(chrono::milliseconds timeout);
+
+private:
+	static int on_connect(const mg_connection* conn, void* user);
+	static void on_ready(mg_connection* conn, void* user);
+	static int on_data(mg_connection* conn, int bits, char* data, size_t len, void* user);
+	static void on_close(const mg_connection* conn, void* user);
+
+	mg_context* context = nullptr;
+	mutex lock;
+	mg_connection* connection = nullptr;
+	bool joined = false;
+	condition_variable join_arrived;
+	MessageQueue requests;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <s2clientprotocol/sc2api.pb.h>
+#include <message_queue.h>
+
+struct mg_connection;
+
+using namespace std;
+
+// Websocket connection from the arena to one sc2 instance. Responses are
+// kept serialized so the relay can hand sc2's bytes straight to the bot;
+// send/receive with protobuf messages are for the arena's own requests.
+class GameConnection {
+public:
+	~GameConnection();
+
+	bool connect(const char* host, int port, bool verbose = true);
+	void disconnect();
+	bool connected();
+
+	bool send(const string& request);
+	bool send(const SC2APIProtocol::Request& request);
+	bool wait_response(string& response, chrono::milliseconds timeout);
+	// Same as BotServer::on_request, for responses
+	void on_response(function<void()> callback) { responses.listen(callback); }
+	bool try_response(string& response) { return responses.try_pop(response); }
+	// Responses waiting for the relay
+	size_t queued() const { return responses.size(); }
+	bool receive(SC2APIProtocol::Response& response, chrono::milliseconds timeout);
+
+private:
+	static int on_data(mg_connection* conn, int bits, char* data, size_t len, void* user);
+	static void on_close(const mg_connection* conn, void* user);
+
+	mutex lock;
+	mg_connection* connection = nullptr;
+	bool closed = true;
+	MessageQueue responses;
+};
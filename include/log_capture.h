@@ -0,0 +1,52 @@
+#pragma once
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// A log file that moves aside once it reaches log_rotate_bytes, keeping
+// log_rotate_keep older files as path.1 (newest) to path.N.
+class RotatingLog {
+public:
+	explicit RotatingLog(const string& path);
+
+	void write(const char* data, size_t len);
+	void flush() { out.flush(); }
+
+private:
+	void rotate();
+
+	string path;
+	ofstream out;
+	size_t written = 0;
+};
+
+// Streams what child processes print into log files. One thread polls
+// the read ends of every process's output pipe, so a bot that prints a
+// lot never blocks on a full pipe and a crashing bot's last words still
+// reach its log. Only on POSIX systems; on Windows processes keep
+// printing to their own console.
+class LogCapture {
+public:
+	static LogCapture& instance();
+	~LogCapture();
+
+	// Pipe whose output ends up in the log at path. Returns the write end
+	// to pass to start_proc, or -1 if output cannot be captured.
+	int open(const string& path);
+
+private:
+	LogCapture();
+	void run();
+	void wake();
+
+	mutex lock;
+	// Read end -> where it goes
+	map<int, RotatingLog*> logs;
+	int wake_pipe[2] = { -1, -1 };
+	bool stopping = false;
+	thread reader;
+};
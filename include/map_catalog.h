@@ -0,0 +1,52 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include <s2clientprotocol/sc2api.pb.h>
+
+using namespace std;
+
+// How create_game gets a local map to sc2
+enum MapDelivery {
+	// The path the map was found at
+	MapByPath,
+	// The map's bytes in LocalMap.map_data, read once at startup
+	MapInline,
+	// A copy made at startup in map_stage_dir, meant to be a tmpfs
+	MapStaged
+};
+
+struct CatalogMap {
+	string name;
+	// Battle.net maps are looked up by sc2 itself
+	bool battlenet = false;
+	// Found on disk, or a Battle.net name
+	bool found = false;
+	// Sent as LocalMap.map_path
+	string path;
+	// Sent as LocalMap.map_data when delivered inline
+	string data;
+};
+
+// Every configured map, resolved once at startup so matches never touch
+// the filesystem to find one.
+class MapCatalog {
+public:
+	MapCatalog(const string& process_path, MapDelivery delivery, const string& stage_dir);
+
+	void add(const vector<string>& names);
+	const CatalogMap* find(const string& name) const;
+	// Points request at the map. Maps that were never added are resolved
+	// on the spot. False if the map was not found locally.
+	bool fill(SC2APIProtocol::RequestCreateGame* request, const string& name) const;
+
+	static bool parse_delivery(const string& value, MapDelivery& delivery);
+
+private:
+	CatalogMap load(const string& name) const;
+
+	string process_path;
+	MapDelivery delivery;
+	string stage_dir;
+	map<string, CatalogMap> maps;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <arena_types.h>
+
+using namespace std;
+
+struct MatchEvent {
+	enum Kind {
+		// A relay returned, status says why
+		RelayDone,
+		// A bot process exited
+		BotExit,
+		// Nothing happened before the deadline
+		Deadline
+	} kind;
+	size_t player;
+	ClientStatus status;
+};
+
+// Where everything that can end a match is reported: relays finishing,
+// bot processes exiting, the match running out of time. The match's
+// thread sleeps in next() and wakes for whichever comes first, instead
+// of polling relays and processes in turn.
+class MatchSupervisor {
+public:
+	~MatchSupervisor();
+
+	// Called from a relay as it returns
+	void relay_done(size_t player, ClientStatus status);
+	// Reports a BotExit when pid exits, until the supervisor goes away.
+	// Takes pidfd, see ProcessWatch::watch.
+	void watch_bot(size_t player, uint64_t pid, int pidfd = -1);
+
+	MatchEvent next(chrono::steady_clock::time_point deadline);
+
+private:
+	void post(const MatchEvent& event);
+
+	mutex lock;
+	condition_variable posted;
+	deque<MatchEvent> events;
+	vector<int> watches;
+};
@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// A buffer bigger than this (an inline map, say) is freed once read
+// rather than kept around for the next message
+#define MESSAGE_RETAIN_BYTES (4 << 20)
+
+// Heap allocations made by every MessageQueue in the process, for
+// checking that steady state relaying allocates nothing
+inline atomic<uint64_t>& message_allocations() {
+	static atomic<uint64_t> count(0);
+	return count;
+}
+
+// Serialized websocket messages waiting to be relayed. Whoever reads
+// either sleeps in wait_pop until a message is pushed or the queue is
+// closed, or sets a listener and drains with try_pop when it is called.
+//
+// Each message keeps the time it was pushed, so a reader that gets round
+// to it late can still tell when it arrived.
+//
+// The queue is a ring of strings that are reused rather than freed. A
+// pop swaps the reader's previous buffer into the slot it empties, so
+// once every buffer has grown to the largest message seen, pushing and
+// popping never touch the heap.
+class MessageQueue {
+public:
+	void push(const char* data, size_t len) {
+		auto now = chrono::steady_clock::now();
+		function<void()> notify;
+		{
+			lock_guard<mutex> guard(lock);
+			if (count == slots.size())
+				grow();
+			size_t tail = (head + count) % slots.size();
+			string& slot = slots[tail];
+			if (slot.capacity() < len)
+				message_allocations().fetch_add(1, memory_order_relaxed);
+			slot.assign(data, len);
+			times[tail] = now;
+			count++;
+			depth.store(count, memory_order_relaxed);
+			notify = listener;
+		}
+		arrived.notify_one();
+		if (notify)
+			notify();
+	}
+
+	// Called after every push and on close, on the pushing thread
+	void listen(function<void()> callback) {
+		lock_guard<mutex> guard(lock);
+		listener = callback;
+	}
+
+	bool try_pop(string& out) {
+		lock_guard<mutex> guard(lock);
+		if (count == 0)
+			return false;
+
+		take(out);
+		return true;
+	}
+
+	// As above, pushed is when the message was pushed
+	bool try_pop(string& out, chrono::steady_clock::time_point& pushed) {
+		lock_guard<mutex> guard(lock);
+		if (count == 0)
+			return false;
+
+		pushed = times[head];
+		take(out);
+		return true;
+	}
+
+	// Closed with nothing left to read
+	bool drained() {
+		lock_guard<mutex> guard(lock);
+		return closed && count == 0;
+	}
+
+	// Moves the oldest message into out. False on timeout or once closed
+	// and drained.
+	bool wait_pop(string& out, chrono::milliseconds timeout) {
+		unique_lock<mutex> guard(lock);
+		arrived.wait_for(guard, timeout, [this] { return count != 0 || closed; });
+		if (count == 0)
+			return false;
+
+		take(out);
+		return true;
+	}
+
+	void open() {
+		lock_guard<mutex> guard(lock);
+		closed = false;
+	}
+
+	void close() {
+		function<void()> notify;
+		{
+			lock_guard<mutex> guard(lock);
+			closed = true;
+			notify = listener;
+		}
+		arrived.notify_all();
+		if (notify)
+			notify();
+	}
+
+	// Drops queued messages but keeps their buffers
+	void clear() {
+		lock_guard<mutex> guard(lock);
+		head = 0;
+		count = 0;
+		depth.store(0, memory_order_relaxed);
+	}
+
+	// Messages waiting, read without the lock for monitoring
+	size_t size() const { return depth.load(memory_order_relaxed); }
+
+private:
+	// Caller holds the lock and count > 0
+	void take(string& out) {
+		string& slot = slots[head];
+		out.swap(slot);
+		if (slot.capacity() > MESSAGE_RETAIN_BYTES)
+			string().swap(slot);
+		slot.clear();
+		head = (head + 1) % slots.size();
+		count--;
+		depth.store(count, memory_order_relaxed);
+	}
+
+	// Caller holds the lock and the ring is full. Relays keep at most a
+	// message or two queued, so this only happens while warming up.
+	void grow() {
+		vector<string> bigger(max<size_t>(slots.size() * 2, 4));
+		vector<chrono::steady_clock::time_point> later(bigger.size());
+		for (size_t i = 0; i < count; i++) {
+			bigger[i].swap(slots[(head + i) % slots.size()]);
+			later[i] = times[(head + i) % slots.size()];
+		}
+		for (size_t i = count; i < slots.size(); i++)
+			bigger[i].swap(slots[(head + i) % slots.size()]);
+		slots.swap(bigger);
+		times.swap(later);
+		head = 0;
+		message_allocations().fetch_add(1, memory_order_relaxed);
+	}
+
+	mutex lock;
+	condition_variable arrived;
+	vector<string> slots;
+	// When each slot's message was pushed
+	vector<chrono::steady_clock::time_point> times;
+	size_t head = 0;
+	size_t count = 0;
+	atomic<size_t> depth{ 0 };
+	bool closed = false;
+	function<void()> listener;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <functional>
+#include <ostream>
+
+struct mg_context;
+struct mg_connection;
+
+using namespace std;
+
+// Serves GET /metrics in the Prometheus text format on the loopback
+// interface. Each scrape calls render on a civetweb thread. Arena's
+// render reads counters the relays update lock-free, so scraping never
+// holds a relay up, and holds the lock on running matches only while it
+// copies them.
+class MetricsServer {
+public:
+	~MetricsServer();
+
+	bool listen(int port, function<void(ostream&)> render);
+	void stop();
+
+private:
+	static int on_request(mg_connection* conn, void* user);
+
+	mg_context* context = nullptr;
+	function<void(ostream&)> render;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+// Hands out blocks of consecutive ports that nothing on this host is
+// listening on. A port is free if it is in no live lease and a socket
+// can be bound to it, so matches, the sc2 pool and anything else on the
+// machine never end up sharing a port.
+class PortAllocator {
+public:
+	// Leases come from first..last inclusive
+	PortAllocator(int first, int last);
+
+	// Start of a block of count free ports, leased until released, or 0
+	// if no such block is left.
+	int lease(size_t count);
+	void release(int start);
+	size_t leased_ports();
+
+	// Whether a listening socket could be bound to port right now
+	static bool probe(int port);
+
+private:
+	int first;
+	int last;
+	// Where the next search starts, so a released block is not handed
+	// straight back while its sockets may still be closing
+	int cursor;
+
+	mutex lock;
+	// Block start -> port count
+	map<int, int> leases;
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+using namespace std;
+
+// Calls back the moment a process exits. On Linux one thread polls a
+// pidfd per watched process, on Windows the wait is registered with the
+// system thread pool, so nobody has to check processes on a timer.
+// Kernels without pidfd_open fall back to checking every
+// PROCESS_WATCH_FALLBACK_MS.
+class ProcessWatch {
+public:
+	static ProcessWatch& instance();
+	~ProcessWatch();
+
+	// on_exit runs on the watcher's thread, at most once. Keep it short.
+	// A pidfd from start_proc saves opening one, which could race with
+	// the pid being reused; the watch owns it from then on.
+	int watch(uint64_t pid, function<void()> on_exit, int pidfd = -1);
+	// Once this returns on_exit is not running and never will.
+	void unwatch(int id);
+
+private:
+	ProcessWatch();
+
+	struct Watch {
+		uint64_t pid;
+		function<void()> on_exit;
+		bool fired = false;
+		// pidfd, -1 if unsupported
+		int handle = -1;
+		// Process and wait registration on Windows
+		void* process = nullptr;
+		void* wait = nullptr;
+	};
+
+	mutex lock;
+	map<int, Watch*> watches;
+	int next_id = 1;
+
+#ifndef _WIN32
+	void run();
+	void wake();
+
+	int wake_pipe[2] = { -1, -1 };
+	bool stopping = false;
+	thread watcher;
+#endif
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <arena_types.h>
+#include <bot_server.h>
+#include <game_connection.h>
+#include <relay_executor.h>
+#include <wire_peek.h>
+
+using namespace std;
+
+// Passes one bot's requests to its sc2 and sc2's responses back. A relay
+// is a task on the RelayExecutor that runs only when its bot or its sc2
+// has sent something, or a timeout is due, so it holds no thread while
+// the bot thinks or sc2 simulates. done is called once, from the
+// executor, with why the relay stopped.
+class Relay : public enable_shared_from_this<Relay> {
+public:
+	static shared_ptr<Relay> start(RelayExecutor& executor, GameConnection* client, BotServer* server,
+		RelayState* state, function<void(ClientStatus)> done);
+
+	// Stops the relay on its next run without waiting on either side.
+	// It reports Running.
+	void cancel();
+
+private:
+	Relay(RelayExecutor& executor, GameConnection* client, BotServer* server,
+		RelayState* state, function<void(ClientStatus)> done);
+
+	void wake();
+	void run();
+	// Handles everything that has arrived, returns once it has to wait
+	void advance();
+	void handle_request(chrono::steady_clock::time_point now);
+	void handle_response(chrono::steady_clock::time_point now);
+	void await_request(chrono::steady_clock::time_point now);
+	void arm(chrono::steady_clock::time_point when);
+	void finish(ClientStatus status);
+
+	RelayExecutor& executor;
+	GameConnection* client;
+	BotServer* server;
+	RelayState* state;
+	function<void(ClientStatus)> done;
+
+	atomic<uint32_t> wakeups{ 0 };
+	atomic<bool> cancelled{ false };
+
+	// Only touched from run, which never runs twice at once
+	bool finished = false;
+	bool awaiting_response = false;
+	ClientStatus status = ClientStatus::Running;
+	SC2APIProtocol::Request::RequestCase pending;
+	chrono::steady_clock::time_point sent;
+	chrono::steady_clock::time_point responded;
+	// When the request being handled reached the bot server
+	chrono::steady_clock::time_point arrived;
+	bool answered = false;
+	// The budget only applies once the game is on, loading is free
+	bool budgeted = false;
+	// Whether deadline is the bot running out of time rather than the bot timeout
+	bool limited = false;
+	chrono::steady_clock::time_point deadline;
+	string message;
+	ResponsePeek peek;
+
+	mutex timer_lock;
+	bool timer_armed = false;
+	chrono::steady_clock::time_point timer_at;
+};
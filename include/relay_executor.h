@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Runs relay work for every match on one set of threads, sized to the
+// cores rather than to players x matches. Each worker has its own
+// queue: tasks submitted from a worker stay on it, others are spread
+// round robin, and a worker that runs dry steals from the rest before
+// it sleeps. Tasks must not block.
+class RelayExecutor {
+public:
+	// 0 for one thread per core
+	explicit RelayExecutor(size_t threads = 0);
+	~RelayExecutor();
+
+	void submit(function<void()> task);
+	// Submits task once when has passed
+	void submit_at(chrono::steady_clock::time_point when, function<void()> task);
+	size_t size() const { return threads.size(); }
+
+private:
+	struct Worker {
+		mutex lock;
+		deque<function<void()>> tasks;
+	};
+
+	struct Timer {
+		chrono::steady_clock::time_point when;
+		function<void()> task;
+		bool operator >(const Timer& other) const { return when > other.when; }
+	};
+
+	void work(size_t index);
+	bool pop(size_t index, function<void()>& task);
+	void run_timers();
+
+	vector<unique_ptr<Worker>> workers;
+	vector<thread> threads;
+	atomic<size_t> next_worker{ 0 };
+	atomic<size_t> queued{ 0 };
+
+	mutex sleep_lock;
+	condition_variable wake;
+	bool stopping = false;
+
+	mutex timer_lock;
+	condition_variable timer_wake;
+	priority_queue<Timer, vector<Timer>, greater<Timer>> timers;
+	thread timer_thread;
+};
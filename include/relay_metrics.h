@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// Bucket b counts latencies up to 2^b us, the last one everything longer,
+// so 2^b is each bucket's Prometheus le
+#define LATENCY_BUCKETS 25
+// One counter per Request oneof case, the highest is below 32
+#define REQUEST_TYPES 32
+// Game loops a realtime game advances per second, at Faster speed
+#define REALTIME_LOOPS_PER_SECOND 22.4
+// Gap bucket g counts observations that skipped under 2^g loops, the
+// last one everything longer
+#define LOOP_GAP_BUCKETS 8
+
+// Latency histogram with a single writer. Only the owning relay records,
+// and a relay's tasks never run on two executor threads at once, so
+// updates are plain relaxed loads and stores with no locked instructions,
+// while any other thread may read a consistent-enough snapshot at any
+// time.
+class LatencyHistogram {
+public:
+	void record(chrono::nanoseconds latency);
+
+	uint64_t count() const { return samples.load(memory_order_relaxed); }
+	uint64_t total_us() const { return sum_us.load(memory_order_relaxed); }
+	uint64_t max_us() const { return peak_us.load(memory_order_relaxed); }
+	// Latencies up to 2^b us and over 2^(b-1), the last bucket is open
+	uint64_t bucket(size_t b) const { return buckets[b].load(memory_order_relaxed); }
+	double mean_ms() const;
+	// Upper edge of the bucket holding quantile q, capped at the max, in ms
+	double quantile_ms(double q) const;
+
+private:
+	atomic<uint64_t> buckets[LATENCY_BUCKETS] = {};
+	atomic<uint64_t> samples{ 0 };
+	atomic<uint64_t> sum_us{ 0 };
+	atomic<uint64_t> peak_us{ 0 };
+};
+
+// One step of the time series
+struct StepSample {
+	uint32_t game_loop;
+	uint32_t bot_us;
+	uint32_t sc2_us;
+};
+
+// Everything a relay measures about its bot and sc2. Bot time runs from
+// a response leaving the arena to the bot's next request arriving, sc2
+// time from a request leaving to its response arriving.
+class RelayMetrics {
+public:
+	RelayMetrics();
+
+	void bot_time(chrono::nanoseconds latency);
+	void sc2_time(int request_type, chrono::nanoseconds latency);
+	// Closes a step for the time series
+	void step(uint32_t game_loop);
+
+	uint64_t steps() const { return step_count.load(memory_order_relaxed); }
+	// Last request or response through the relay, or when it started
+	chrono::steady_clock::time_point last_activity() const {
+		return chrono::steady_clock::time_point(chrono::steady_clock::duration(last_ns.load(memory_order_relaxed)));
+	}
+	uint64_t requests(int request_type) const;
+
+	const LatencyHistogram& bot() const { return bot_latency; }
+	const LatencyHistogram& sc2() const { return sc2_latency; }
+	const LatencyHistogram& sc2_step() const { return step_latency; }
+	// Only safe to read once the relay has finished
+	const vector<StepSample>& series() const { return samples; }
+
+	void print_summary(ostream& out, const string& name) const;
+
+private:
+	LatencyHistogram bot_latency;
+	LatencyHistogram sc2_latency;
+	LatencyHistogram step_latency;
+	atomic<uint64_t> request_count[REQUEST_TYPES] = {};
+	atomic<uint64_t> request_us[REQUEST_TYPES] = {};
+	atomic<uint64_t> step_count{ 0 };
+	atomic<int64_t> last_ns{ 0 };
+
+	// Times since the last step, for its sample
+	uint64_t pending_bot_us = 0;
+	uint64_t pending_sc2_us = 0;
+	vector<StepSample> samples;
+};
+
+// How a bot keeps up with a realtime game, where sc2 runs on its own at
+// REALTIME_LOOPS_PER_SECOND instead of waiting for steps. The bot sees
+// the loops it asks observations for and misses the ones in between,
+// and its actions land however many loops after the observation they
+// answer. Single writer, like LatencyHistogram.
+class RealtimeMetrics {
+public:
+	// An observation of game_loop left for the bot at time at
+	void observed(uint32_t game_loop, chrono::steady_clock::time_point at);
+	// The bot sent actions
+	void acted(chrono::steady_clock::time_point at);
+
+	uint64_t observations() const { return observation_count.load(memory_order_relaxed); }
+	uint64_t missed_loops() const { return missed.load(memory_order_relaxed); }
+	uint64_t max_gap() const { return peak_gap.load(memory_order_relaxed); }
+	// From the last observation to the actions that follow it
+	const LatencyHistogram& action_latency() const { return latency; }
+	// Most loops sc2 fell behind the wall clock, which it does when the
+	// host cannot keep up
+	double max_lag_loops() const { return peak_lag.load(memory_order_relaxed) / 1000.0; }
+
+	void print_summary(ostream& out) const;
+
+private:
+	LatencyHistogram latency;
+	atomic<uint64_t> observation_count{ 0 };
+	atomic<uint64_t> missed{ 0 };
+	atomic<uint64_t> peak_gap{ 0 };
+	atomic<uint64_t> gaps[LOOP_GAP_BUCKETS] = {};
+	// Thousandths of a loop
+	atomic<uint64_t> peak_lag{ 0 };
+
+	bool started = false;
+	chrono::steady_clock::time_point origin;
+	uint32_t origin_loop = 0;
+	uint32_t last_loop = 0;
+	// Only the first actions after an observation answer it
+	bool answered = true;
+	chrono::steady_clock::time_point last_observation;
+};
+
+// One row per step per player: seat,game_loop,bot_us,sc2_us
+bool write_series(const string& path, const vector<const RelayMetrics*>& players);
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+#define TRACE_MAGIC "sc2arena-trace-1\n"
+
+enum TraceDirection : uint8_t {
+	// Bot to sc2
+	TraceRequest = 0,
+	// sc2 to bot
+	TraceResponse = 1
+};
+
+struct TraceRecord {
+	TraceDirection direction;
+	// Since the trace started
+	uint64_t ns;
+	string message;
+};
+
+// Every message one relay passed on, as the bytes it passed, in order.
+// Each record is a direction byte, a timestamp and a length followed by
+// the message, fixed fields in host byte order. Writes go through a
+// large buffer, so the relay only pays for a copy per message.
+class TraceWriter {
+public:
+	explicit TraceWriter(const string& path);
+
+	bool is_open() const { return out.is_open(); }
+	void record(TraceDirection direction, const string& message);
+
+private:
+	vector<char> buffer;
+	ofstream out;
+	chrono::steady_clock::time_point start;
+};
+
+bool load_trace(const string& path, vector<TraceRecord>& records);
@@ -0,0 +1,66 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <arena_types.h>
+
+using namespace std;
+
+// Where one replay lives in the archive, and the match it is from.
+struct ReplayEntry {
+	// Data file, one per day the matches started on
+	string file;
+	uint64_t offset;
+	uint64_t stored_size;
+	uint64_t size;
+	time_t started;
+	string map;
+	vector<string> players;
+	int result;
+};
+
+// Replays of finished matches, zlib compressed and appended to one data
+// file per day, with a tab separated index of every entry. Nothing is
+// ever rewritten, so a crash loses at most the entry being written.
+// add only queues the replay; compressing and writing happen on the
+// archive's own thread so the next match is not held up.
+class ReplayArchive {
+public:
+	explicit ReplayArchive(const string& dir);
+	~ReplayArchive();
+
+	void add(const MatchRecord& match, string replay);
+	// Blocks until everything added so far is written.
+	void flush();
+
+	// Entries matching every filter given, "" and 0 match anything.
+	vector<ReplayEntry> find(const string& bot, const string& map, time_t from, time_t to);
+	bool read(const ReplayEntry& entry, string& replay);
+
+private:
+	struct Pending {
+		MatchRecord match;
+		string replay;
+	};
+
+	void writer();
+	bool write(const Pending& pending);
+	void load_index();
+
+	string dir;
+	string index_path;
+
+	mutex lock;
+	condition_variable queued;
+	condition_variable written;
+	deque<Pending> pending;
+	bool writing = false;
+	bool stopping = false;
+	vector<ReplayEntry> entries;
+	thread writer_thread;
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <arena_types.h>
+
+using namespace std;
+
+struct ResourceLimits {
+	// Percent of one core, 0 for no quota
+	int cpu_percent = 0;
+	// 0 for no cap
+	int memory_mb = 0;
+	// Pin the group to the core fewest other groups are pinned to
+	bool pin_cpu = false;
+};
+
+// A cgroup v2 group under the cgroup_root setting holding one bot or sc2 instance
+// and everything it starts, so a noisy process cannot take CPU or memory
+// from the games beside it. A match's bots are grouped under a slice of
+// its own, which kills them all with one write and whose usage is theirs
+// together. Without a writable cgroup v2 hierarchy, and
+// on other platforms, a group is inert: processes run unconstrained and
+// usage is read from the process itself.
+class ResourceGroup {
+public:
+	// Under parent if it is active, under cgroup_root otherwise
+	ResourceGroup(const string& name, const ResourceLimits& limits, const ResourceGroup* parent = nullptr);
+	// Removes the group, waiting a moment for processes kill() left dying.
+	// Groups under it must be gone first.
+	~ResourceGroup();
+
+	// Whether groups can be created at all. Sets up cgroup_root the first
+	// time it is called.
+	static bool available();
+
+	bool active() const { return !dir.empty(); }
+	// Directory to start processes in, see start_proc. "" if inactive.
+	const string& path() const { return dir; }
+	// Everything that ran in the group so far. An inert group reports on
+	// pid alone, and has to be asked before the process is reaped. Once
+	// it has exited only its CPU time is left.
+	ResourceUsage usage(uint64_t pid) const;
+	// The same for the group at dir, path() of a group that may since have
+	// been removed, which then reads as nothing used
+	static ResourceUsage usage_at(const string& dir, uint64_t pid);
+	// Kills every process in the group and the groups under it, including
+	// ones the main process started. False if the group is inert or the kernel predates
+	// cgroup.kill.
+	bool kill();
+
+private:
+	string dir;
+	int cpu = -1;
+};
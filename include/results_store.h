@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <arena_types.h>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+using namespace std;
+
+struct Rating {
+	string name;
+	double elo;
+	// Glicko-1, every game is its own rating period
+	double glicko;
+	double glicko_rd;
+	int games;
+	int wins;
+	int losses;
+	int draws;
+};
+
+struct HeadToHead {
+	int wins = 0;
+	int losses = 0;
+	int draws = 0;
+};
+
+// Match results and ratings in SQLite. record only queues the match; a
+// writer thread commits everything queued in one transaction, so any
+// number of scheduler slots can report results without waiting on the
+// database or on each other. The database runs in WAL mode so queries
+// can read while the writer commits.
+class ResultsStore {
+public:
+	explicit ResultsStore(const string& path);
+	~ResultsStore();
+
+	bool is_open() const { return db != nullptr; }
+	void record(const MatchRecord& match);
+	// Blocks until everything recorded so far is committed.
+	void flush();
+
+	vector<Rating> leaderboard(size_t limit);
+	HeadToHead head_to_head(const string& bot, const string& opponent);
+
+private:
+	void writer();
+	bool write_batch(const vector<MatchRecord>& batch);
+	bool write_match(const MatchRecord& match);
+	int64_t player_id(const string& name);
+	int64_t map_id(const string& name);
+	void update_ratings(const MatchRecord& match, const vector<int64_t>& ids);
+	bool exec(const char* sql);
+
+	sqlite3* db = nullptr;
+	sqlite3* reader = nullptr;
+
+	mutex lock;
+	condition_variable queued;
+	condition_variable written;
+	vector<MatchRecord> pending;
+	size_t in_flight = 0;
+	bool stopping = false;
+	thread writer_thread;
+};
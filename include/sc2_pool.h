@@ -0,0 +1,66 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <s2clientprotocol/sc2api.pb.h>
+#include <game_connection.h>
+#include <port_allocator.h>
+#include <resource_group.h>
+
+using namespace std;
+
+// A running sc2 process and the arena's connection to it.
+struct Sc2Instance {
+	uint64_t pid;
+	int port;
+	GameConnection* connection;
+	// The instance's cgroup, for its limits and usage
+	ResourceGroup* group;
+	// Games hosted since launch, instances are recycled after sc2_max_games
+	int games;
+};
+
+// Launched sc2 instances kept alive between matches. Launching and
+// waiting for sc2 dominates a short match, so a finished game is left
+// and the instance handed to the next match instead.
+class Sc2Pool {
+public:
+	// extra_args go to every instance after the usual options. Each
+	// instance leases its port from ports.
+	Sc2Pool(string process_path, string data_version, vector<string> extra_args, PortAllocator& ports, size_t max_instances);
+	~Sc2Pool();
+
+	// Launches instances until count are idle.
+	void warm(size_t count);
+	// Takes count healthy instances, launching more if there are not
+	// enough idle. Returns fewer than count only if launching failed.
+	vector<Sc2Instance*> acquire(size_t count);
+	// Resets an instance after a game and makes it available again, or
+	// kills it if it cannot be reset.
+	void release(Sc2Instance* instance);
+	vector<uint64_t> pids();
+
+	// Sends request and waits for the response with the same id.
+	static bool call(Sc2Instance* instance, SC2APIProtocol::Request& request, SC2APIProtocol::Response& response);
+	static bool ping(Sc2Instance* instance, SC2APIProtocol::Status& status);
+
+private:
+	vector<Sc2Instance*> launch(size_t count);
+	bool wait_ready(Sc2Instance* instance, chrono::steady_clock::time_point deadline);
+	bool reset(Sc2Instance* instance);
+	void retire(Sc2Instance* instance);
+
+	string process_path;
+	string data_version;
+	vector<string> extra_args;
+	PortAllocator& ports;
+	size_t max_instances;
+
+	mutex lock;
+	vector<Sc2Instance*> idle;
+	vector<Sc2Instance*> all;
+	// Alive or being launched, at most max_instances
+	size_t instances = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <arena.h>
+#include <results_store.h>
+
+using namespace std;
+
+struct MatchSpec {
+	vector<Bot> bots;
+	string map;
+	// The caller's id for the match, handed back in its outcome
+	int id = -1;
+};
+
+struct MatchOutcome {
+	MatchSpec spec;
+	MatchRecord record;
+};
+
+// Plays queued matches on a fixed number of slots. Every match leases
+// its own port block, so any number of them can share the host.
+class Scheduler {
+public:
+	// 0 sizes the slots to the host, see default_slots
+	explicit Scheduler(size_t slots = 0, size_t players_per_match = 2);
+	~Scheduler();
+
+	// Runs on the slot's thread once a match ends. Safe to enqueue from.
+	void on_finished(function<void(const MatchOutcome&)> callback);
+	// Every finished match is also recorded here, if set.
+	void record_to(ResultsStore* store);
+	void enqueue(const MatchSpec& spec);
+	// Blocks until the queue is empty and no match is running.
+	void wait();
+	size_t size() const { return workers.size(); }
+
+	// How many matches fit on this host: one core and sc2_memory_mb per
+	// sc2 instance.
+	static size_t default_slots(size_t players_per_match);
+
+private:
+	void worker(size_t slot);
+
+	vector<thread> workers;
+	function<void(const MatchOutcome&)> finished;
+	ResultsStore* results = nullptr;
+
+	mutex lock;
+	condition_variable queued;
+	condition_variable idle;
+	deque<MatchSpec> pending;
+	size_t active = 0;
+	bool stopping = false;
+};
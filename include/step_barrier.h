@@ -0,0 +1,65 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <game_connection.h>
+#include <relay_metrics.h>
+
+using namespace std;
+
+// Coordinated stepping for one match. Each relay hands its player's step
+// request over instead of sending it, and once every player still in
+// the game has one waiting they all go to their sc2 instances at once.
+// sc2 keeps multiplayer games in lockstep anyway, so an early step only
+// sat inside sc2 until the slowest bot caught up; held here, the wait is
+// measured and the instances start simulating the loop together.
+// Anything other than a step is never held, so the observations bots ask
+// for after a step go straight through while the others are still busy.
+class StepBarrier {
+public:
+	// One seat per player, each stepping through its own connection
+	explicit StepBarrier(const vector<GameConnection*>& connections);
+
+	// Takes seat's step request, swapping the caller's string for an
+	// empty buffer. Sends every held step if seat was the last one out.
+	// False if seat has left, the caller then sends the step itself.
+	bool arrive(size_t seat, string& step);
+	// seat's relay stopped, the others no longer wait for it. Drops its
+	// step if one was held.
+	void leave(size_t seat);
+	// When seat's last step actually went to sc2
+	chrono::steady_clock::time_point dispatched(size_t seat);
+
+	uint64_t loops() const { return wait.count(); }
+	// First step of a loop arriving to the last one, per loop
+	const LatencyHistogram& slowest_wait() const { return wait; }
+	// Loops seat's step was the one everyone waited on
+	uint64_t slowest(size_t seat);
+
+	void print_summary(ostream& out, const vector<string>& names);
+
+private:
+	// Caller holds the lock
+	void release_if_ready(chrono::steady_clock::time_point now);
+
+	struct Seat {
+		GameConnection* connection;
+		bool active = true;
+		bool held = false;
+		string step;
+		chrono::steady_clock::time_point dispatched;
+		uint64_t slowest = 0;
+	};
+
+	mutex lock;
+	vector<Seat> seats;
+	size_t held = 0;
+	size_t active = 0;
+	chrono::steady_clock::time_point first;
+	size_t last = 0;
+	// Written under the lock, so by one thread at a time
+	LatencyHistogram wait;
+};
@@ -1,7 +1,86 @@
 #pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <arena_types.h>
+#include <scheduler.h>
+
+using namespace std;
 
 enum TournamentType {
 	SingleElim,
 	DoubleElim,
 	RoundRobin
 };
+
+// Where a tournament match gets one of its two players from: a fixed bot,
+// the winner or loser of an earlier match, or nobody (a bye).
+struct Seat {
+	enum Kind { Player, Winner, Loser, Bye } kind;
+	// Bot index for Player, match id for Winner/Loser
+	int index;
+};
+
+struct TournamentMatch {
+	int id;
+	string map;
+	Seat seats[2];
+
+	// Bot index per seat once known, -1 for a bye
+	int players[2] = { -1, -1 };
+	bool scheduled = false;
+	bool done = false;
+	// Times it failed on the arena's side and was queued again
+	int attempts = 0;
+	int result = ArenaResult::None;
+	// Bot indices, -1 for a bye
+	int winner = -1;
+	int loser = -1;
+};
+
+// Expands bots x maps into matches and plays them on a scheduler. A match
+// is queued the moment the matches feeding it have finished, so
+// independent bracket branches and round robin games run side by side.
+// Every result is appended to a checkpoint file; a tournament started
+// again with the same file skips what was already played.
+class Tournament {
+public:
+	Tournament(TournamentType type, vector<Bot> bots, vector<string> maps, string checkpoint_path);
+
+	void run(Scheduler& scheduler);
+
+	const vector<TournamentMatch>& get_matches() const { return matches; }
+	// Elimination winner, -1 for round robin or an unfinished bracket
+	int champion() const;
+	// Wins per bot, draws count half
+	vector<double> standings() const;
+
+private:
+	int add_match(Seat a, Seat b, const string& map);
+	Seat winner_of(int id) const { return { Seat::Winner, id }; }
+	Seat loser_of(int id) const { return { Seat::Loser, id }; }
+	vector<int> add_round(const vector<Seat>& seats, const string& map);
+	void build_round_robin();
+	void build_single_elim();
+	void build_double_elim();
+	vector<int> build_winners_bracket(vector<vector<int>>& rounds);
+
+	bool resolve(Seat seat, int& player) const;
+	void finish(TournamentMatch& match, int result);
+	void schedule_ready(Scheduler* scheduler);
+
+	void load_checkpoint();
+	void save_checkpoint(const TournamentMatch& match);
+
+	TournamentType type;
+	vector<Bot> bots;
+	vector<string> maps;
+	string checkpoint_path;
+	// The file at checkpoint_path is for another tournament, the first
+	// save starts it over
+	bool stale_checkpoint = false;
+	int final_match = -1;
+
+	mutex lock;
+	vector<TournamentMatch> matches;
+};
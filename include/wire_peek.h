@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <s2clientprotocol/sc2api.pb.h>
+#include <arena_types.h>
+
+using namespace std;
+
+// The few fields the relay needs from a response, read straight off the
+// wire. Parsing the whole Response would build the entire Observation
+// (raw units, map bitmaps) every step only to look at game_loop.
+struct ResponsePeek {
+	SC2APIProtocol::Response::ResponseCase type;
+	int status;
+	bool has_game_loop;
+	uint32_t game_loop;
+	// From a join_game response, 0 otherwise
+	uint32_t player_id;
+	// SC2APIProtocol::Result indexed by player id, 0 if sc2 sent none.
+	bool has_results;
+	int results[MAX_PLAYERS + 1];
+};
+
+SC2APIProtocol::Request::RequestCase peek_request(const char* data, size_t len);
+SC2APIProtocol::Request::RequestCase peek_request(const string& request);
+bool peek_response(const string& response, ResponsePeek& peek);
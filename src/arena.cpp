@@ -1,276 +1,823 @@
 #include <arena.h>
-#include <iostream>
+#include <arena_log.h>
+#include <sstream>
 #include <time.h>
 #include <vector>
 #include <string>
-#include <future>
+#include <thread>
+#include <algorithm>
 #include <sc2api/sc2_args.h>
 #include <sc2api/sc2_game_settings.h>
-#include <sc2api/sc2_connection.h>
 #include <sc2utils/sc2_manage_process.h>
+#include <arena_config.h>
 #include <arena_process.h>
+#include <arena_settings.h>
+#include <log_capture.h>
+#include <wire_peek.h>
+#include <match_supervisor.h>
+#include <message_queue.h>
+#include <relay.h>
+#include <relay_trace.h>
+#include <step_barrier.h>
 
 using namespace std;
 
-void Arena::init(vector<Bot> bots, vector<string> maps) {
-	Arena::bots = bots;
+vector<Bot> Arena::bots;
+size_t Arena::num_players;
+vector<string> Arena::maps;
+size_t Arena::num_maps;
+
+sc2::ProtoInterface Arena::proto;
+sc2::ProcessSettings Arena::process_settings;
+sc2::GameSettings Arena::game_settings;
+
+PortAllocator* Arena::ports;
+Sc2Pool* Arena::pool;
+RelayExecutor* Arena::executor;
+ReplayArchive* Arena::archive;
+MapCatalog* Arena::catalog;
+vector<Match*> Arena::running;
+mutex Arena::running_lock;
+
+uint64_t Arena::kill_procs() {
+	uint64_t res = 0;
+	lock_guard<mutex> guard(running_lock);
+	for (Match* m : running) {
+		// One write takes all of a match's bots, each group on its own
+		// only if the slice could not be made
+		if (m->group == nullptr || !m->group->kill())
+			for (ResourceGroup* g : m->groups)
+				g->kill();
+		for (uint64_t pid : m->pids)
+			if (!kill_proc(pid))
+				res = pid;
+	}
+	if (pool != nullptr)
+		for (uint64_t pid : pool->pids())
+			if (!kill_proc(pid))
+				res = pid;
+
+	return res;
+}
+
+// Escapes a Prometheus label value
+static string label_value(const string& s) {
+	string res;
+	for (char c : s) {
+		if (c == '\\' || c == '"')
+			res += '\\';
+		if (c == '\n')
+			res += "\\n";
+		else
+			res += c;
+	}
+	return res;
+}
+
+// A LatencyHistogram's counters at one moment
+struct HistogramSnapshot {
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t total_us;
+
+	void take(const LatencyHistogram& h) {
+		for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+			buckets[b] = h.bucket(b);
+		total_us = h.total_us();
+	}
+};
+
+// One player of a running match as the metrics see it, copied under
+// running_lock so that no output is written and nothing read from disk
+// while matches wait to start or finish
+struct MetricsRow {
+	string labels;
+	uint32_t game_loop;
+	uint64_t steps;
+	chrono::steady_clock::time_point last_activity;
+	size_t requests_queued;
+	size_t responses_queued;
+	HistogramSnapshot bot;
+	HistogramSnapshot sc2_step;
+	// Read once the lock is released; a group removed meanwhile reads as
+	// nothing used
+	string bot_group;
+	uint64_t bot_pid;
+	string sc2_group;
+	uint64_t sc2_pid;
+};
+
+static void write_family(ostream& out, const char* name, const char* type, const char* help) {
+	out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+static void write_histogram(ostream& out, const char* name, const char* help, const vector<MetricsRow>& rows,
+	HistogramSnapshot MetricsRow::*histogram) {
+	write_family(out, name, "histogram", help);
+	for (auto const& r : rows) {
+		const HistogramSnapshot& h = r.*histogram;
+		// Reads race the relay, so the count is the buckets' sum rather
+		// than the sample counter, keeping +Inf in line with the buckets
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b < LATENCY_BUCKETS - 1; b++) {
+			cumulative += h.buckets[b];
+			out << name << "_bucket{" << r.labels << ",le=\"" << double(uint64_t(1) << b) / 1e6 << "\"} " << cumulative << "\n";
+		}
+		cumulative += h.buckets[LATENCY_BUCKETS - 1];
+		out << name << "_bucket{" << r.labels << ",le=\"+Inf\"} " << cumulative << "\n";
+		out << name << "_sum{" << r.labels << "} " << h.total_us / 1e6 << "\n";
+		out << name << "_count{" << r.labels << "} " << cumulative << "\n";
+	}
+}
+
+// Under running_lock only the relays' relaxed atomics and what was set
+// before a match was published in states are copied; the lock keeps the
+// match from being torn down meanwhile. Writing the output and the
+// cgroup and /proc reads come after.
+void Arena::write_metrics(ostream& out) {
+	vector<MetricsRow> rows;
+	size_t matches;
+	{
+		lock_guard<mutex> guard(running_lock);
+		matches = running.size();
+		for (const Match* m : running) {
+			if (m->states == nullptr)
+				continue;
+			for (size_t i = 0; i < m->bots.size() && i < m->states->size(); i++) {
+				const RelayState& state = (*m->states)[i];
+				const Sc2Instance* instance = m->instances[i];
+				MetricsRow r;
+				r.labels = "match=\"" + to_string(m->record.started) + "_" + to_string(m->port_start)
+					+ "\",map=\"" + label_value(m->map) + "\",bot=\"" + label_value(m->bots[i].name)
+					+ "\",seat=\"" + to_string(i) + "\"";
+				r.game_loop = state.game_loop.load(memory_order_relaxed);
+				r.steps = state.metrics.steps();
+				r.last_activity = state.metrics.last_activity();
+				r.requests_queued = m->servers[i]->queued();
+				r.responses_queued = instance->connection->queued();
+				r.bot.take(state.metrics.bot());
+				r.sc2_step.take(state.metrics.sc2_step());
+				r.bot_group = m->groups[i]->path();
+				r.bot_pid = m->pids[i];
+				r.sc2_group = instance->group->path();
+				r.sc2_pid = instance->pid;
+				rows.push_back(r);
+			}
+		}
+	}
+	auto now = chrono::steady_clock::now();
+
+	write_family(out, "sc2arena_matches_running", "gauge", "Matches being played, including ones still starting.");
+	out << "sc2arena_matches_running " << matches << "\n";
+	write_family(out, "sc2arena_message_buffers_allocated_total", "counter", "Buffers the relay message queues had to allocate.");
+	out << "sc2arena_message_buffers_allocated_total " << message_allocations().load(memory_order_relaxed) << "\n";
+
+	write_family(out, "sc2arena_game_loop", "gauge", "Last game loop sc2 reported to the player.");
+	for (auto const& r : rows)
+		out << "sc2arena_game_loop{" << r.labels << "} " << r.game_loop << "\n";
+	write_family(out, "sc2arena_steps_total", "counter", "Steps relayed, rate() gives steps per second.");
+	for (auto const& r : rows)
+		out << "sc2arena_steps_total{" << r.labels << "} " << r.steps << "\n";
+	write_family(out, "sc2arena_relay_idle_seconds", "gauge", "Time since the player's last request or response, high when a game has stalled.");
+	for (auto const& r : rows)
+		out << "sc2arena_relay_idle_seconds{" << r.labels << "} "
+			<< chrono::duration<double>(now - r.last_activity).count() << "\n";
+	write_family(out, "sc2arena_request_queue_depth", "gauge", "Bot requests waiting for the relay.");
+	for (auto const& r : rows)
+		out << "sc2arena_request_queue_depth{" << r.labels << "} " << r.requests_queued << "\n";
+	write_family(out, "sc2arena_response_queue_depth", "gauge", "sc2 responses waiting for the relay.");
+	for (auto const& r : rows)
+		out << "sc2arena_response_queue_depth{" << r.labels << "} " << r.responses_queued << "\n";
+
+	write_histogram(out, "sc2arena_bot_think_seconds", "From a response reaching the bot to its next request.", rows,
+		&MetricsRow::bot);
+	write_histogram(out, "sc2arena_sc2_step_seconds", "From a step reaching sc2 to its response.", rows,
+		&MetricsRow::sc2_step);
+
+	// Usage comes from the cgroup, or /proc for an inert group
+	write_family(out, "sc2arena_bot_cpu_seconds_total", "counter", "CPU the bot and everything it started used.");
+	vector<ResourceUsage> usage;
+	for (auto const& r : rows) {
+		usage.push_back(ResourceGroup::usage_at(r.bot_group, r.bot_pid));
+		out << "sc2arena_bot_cpu_seconds_total{" << r.labels << "} " << usage.back().cpu_ms / 1000.0 << "\n";
+	}
+	write_family(out, "sc2arena_bot_peak_rss_bytes", "gauge", "Most memory the bot has held.");
+	for (size_t i = 0; i < rows.size(); i++)
+		out << "sc2arena_bot_peak_rss_bytes{" << rows[i].labels << "} " << usage[i].peak_rss_kb * 1024 << "\n";
+	write_family(out, "sc2arena_sc2_peak_rss_bytes", "gauge", "Most memory the player's sc2 instance has held.");
+	for (auto const& r : rows)
+		out << "sc2arena_sc2_peak_rss_bytes{" << r.labels << "} " << ResourceGroup::usage_at(r.sc2_group, r.sc2_pid).peak_rss_kb * 1024 << "\n";
+}
+
+void Arena::sig_handler() {
+	uint64_t res = kill_procs();
+	if (res != 0)
+		LOG_ERROR(nullptr, "Failed to kill some subprocess " << res);
+	else
+		LOG_INFO(nullptr, "Killed all subprocesses");
+
+	shutdown();
+	ArenaLog::instance().flush();
+	exit(1);
+}
+
+void Arena::configure(const ArenaConfig& config, int argc, char* argv[]) {
+	Arena::bots = config.bots;
 	num_players = bots.size();
-	Arena::maps = maps;
+	Arena::maps = config.maps;
 	num_maps = maps.size();
+	settings = config.settings;
+	sc2::ParseSettings(argc, argv, process_settings, game_settings);
+	if (!config.sc2_path.empty())
+		process_settings.process_path = config.sc2_path;
+	process_settings.extra_command_lines.insert(process_settings.extra_command_lines.end(),
+		config.sc2_args.begin(), config.sc2_args.end());
 }
 
-void Arena::resolve_map(SC2APIProtocol::RequestCreateGame* request, string map_name, string proc_path) {
-	// BattleNet map
-	if (!sc2::HasExtension(map_name, ".SC2Map")) {
-		request->set_battlenet_map_name(map_name);
-		return;
-	}
+void Arena::init() {
+	ports = new PortAllocator(settings.port_first, settings.port_last);
+	pool = new Sc2Pool(process_settings.process_path, process_settings.data_version,
+		process_settings.extra_command_lines, *ports, size_t(settings.sc2_pool_size));
+	executor = new RelayExecutor(size_t(settings.relay_threads));
+	// An unknown delivery is reported by validate_config
+	MapDelivery delivery = MapDelivery::MapByPath;
+	MapCatalog::parse_delivery(settings.map_delivery, delivery);
+	catalog = new MapCatalog(process_settings.process_path, delivery, settings.map_stage_dir);
+	catalog->add(maps);
+
+}
+
+void Arena::shutdown() {
+	// The relays first, they still hold the pool's connections
+	delete executor;
+	executor = nullptr;
+	// Kills and reaps the warm instances and removes their groups
+	delete pool;
+	pool = nullptr;
+	delete catalog;
+	catalog = nullptr;
+	delete ports;
+	ports = nullptr;
+}
 
+string Arena::map_file(string map_name, string proc_path) {
 	// Absolute path
-	SC2APIProtocol::LocalMap* local_map = request->mutable_local_map();
-	if (sc2::DoesFileExist(map_name)) {
-		local_map->set_map_path(map_name);
-		return;
-	}
+	if (sc2::DoesFileExist(map_name))
+		return map_name;
 
 	// Relative path - Game maps directory
 	string game_relative = sc2::GetGameMapsDirectory(proc_path) + map_name;
-	if (sc2::DoesFileExist(game_relative)) {
-		local_map->set_map_path(map_name);
-		return;
-	}
+	if (sc2::DoesFileExist(game_relative))
+		return game_relative;
 
 	// Relative path - Library maps directory
 	string library_relative = sc2::GetLibraryMapsDirectory() + map_name;
-	if (sc2::DoesFileExist(library_relative)) {
-		local_map->set_map_path(library_relative);
-		return;
-	}
+	if (sc2::DoesFileExist(library_relative))
+		return library_relative;
 
-	// Relative path - Remotely saved maps directory
-	local_map->set_map_path(map_name);
+	return "";
 }
 
-ClientStatus client_tick(sc2::Connection* client, sc2::Server* server) {
-	auto client_status = ClientStatus::Running;
-	clock_t last_request = clock();
+bool Arena::resolve_map(SC2APIProtocol::RequestCreateGame* request, string map_name, string proc_path) {
+	// BattleNet map
+	if (!sc2::HasExtension(map_name, ".SC2Map")) {
+		request->set_battlenet_map_name(map_name);
+		return true;
+	}
 
-	while (client_status == ClientStatus::Running) {
-		if (server->HasRequest()) {
-			if (server->PeekRequest().second->has_quit()) {
-				client_status = ClientStatus::Quit;
-				// Intercept leave game and quit requests, we want to keep game alive to save replays
-				break;
-			}
-			else if (server->connections_.size() <= 0 || client->connection_ == nullptr) {
-				client_status = ClientStatus::ClientTimeout;
-				break;
-			}
+	SC2APIProtocol::LocalMap* local_map = request->mutable_local_map();
+	string file = map_file(map_name, proc_path);
+	// Relative path - Remotely saved maps directory
+	local_map->set_map_path(file.empty() ? map_name : file);
+	return !file.empty();
+}
 
-			server->SendRequest(client->connection_);
+static string race_string(sc2::Race race) {
+	switch (race) {
+	case sc2::Race::Protoss:	return "Protoss";
+	case sc2::Race::Random:		return "Random";
+	case sc2::Race::Terran:		return "Terran";
+	case sc2::Race::Zerg:		return "Zerg";
+	default:					return "Random";
+	}
+}
 
-			// Block for sc2's response then queue it.
-			SC2APIProtocol::Response* response = nullptr;
-			client->Receive(response, GAME_TIMEOUT);
-			if (response != nullptr) {
-				auto status = response->status();
-				if (status > SC2APIProtocol::Status::in_replay) {
-					client_status = ClientStatus::GameEnd;
-				}
-				if (response->has_observation()) {
-					const auto obs = response->observation().observation();
-					if (obs.game_loop() > ARENA_GAME_TIMEOUT) {
-						client_status = ClientStatus::GameTimeout;
-					}
-				}
+static string difficulty_string(sc2::Difficulty InDifficulty)
+{
+	switch (InDifficulty) {
+	case sc2::Difficulty::VeryEasy:		return "VeryEasy";
+	case sc2::Difficulty::Easy:			return "Easy";
+	case sc2::Difficulty::Medium:		return "Medium";
+	case sc2::Difficulty::MediumHard:	return "MediumHard";
+	case sc2::Difficulty::Hard:			return "Hard";
+	case sc2::Difficulty::HardVeryHard:	return "HardVeryHard";
+	case sc2::Difficulty::VeryHard:		return "VeryHard";
+	case sc2::Difficulty::CheatVision:	return "CheatVision";
+	case sc2::Difficulty::CheatMoney:	return "CheatMoney";
+	case sc2::Difficulty::CheatInsane:	return "CheatInsane";
+	default:							return "Easy";
+	}
+}
 
-				// Send the response back to the client.
-				server->QueueResponse(client->connection_, response);
-				server->SendResponse();
-			}
-			else {
-				cout << "Null response dammit\n";
-			}
+size_t Arena::match_ports(size_t players) {
+	return 3 * players + 1;
+}
 
+int Arena::bot_port(const Match& match, size_t player) {
+	return match.port_start + int(player);
+}
 
+int Arena::game_port_start(const Match& match) {
+	return match.port_start + int(match.bots.size());
+}
 
-			last_request = clock();
-		}
-		//else if ((last_request + (50 * CLOCKS_PER_SEC)) < clock()) {
-		//	cout << "Client timeout in loop" << endl;
-		//	client_status = ClientStatus::ClientTimeout;
-		//}
-		this_thread::sleep_for(std::chrono::nanoseconds(12ns));
+vector<string> Arena::make_args(const Match& match, size_t player) {
+	const Bot& bot = match.bots[player];
+	// One argv element per token, start_proc joins them on Windows
+	vector<string> res = {
+		"--GamePort", to_string(bot_port(match, player)),
+		"--StartPort", to_string(game_port_start(match)),
+		"--LadderServer", "127.0.0.1"
+	};
+	if (settings.realtime)
+		res.push_back("--RealTime");
+
+	if (bot.type == sc2::PlayerType::Computer) {
+		res.insert(res.end(), {
+			"--ComputerOpponent", "1",
+			"--ComputerRace", race_string(bot.race),
+			"--ComputerDifficulty", difficulty_string(bot.difficulty)
+		});
 	}
 
-	return client_status;
+	return res;
 }
 
-void Arena::start_sc2(int port, int argc, char* argv[]) {
+bool Arena::start_sc2(Match& match) {
+	size_t players = match.bots.size();
 	// 1) Launch two game instances with separate ports.
 	// Setup sc2api websocket server
-	for (int i = 0; i < num_players; i++) {
-		sc2::Server* s = new sc2::Server();
-		servers.push_back(s);
-		cout << "Player " << i << ", port:" << port << endl;
-		s->Listen(to_string(port++).c_str(), REQUEST_TIMEOUT, REQUEST_TIMEOUT, GAME_THREADS);
+	for (size_t i = 0; i < players; i++) {
+		BotServer* s = new BotServer();
+		match.servers.push_back(s);
+		LOG_INFO(&match.log, "Player " << i << ", port:" << bot_port(match, i));
+		s->listen(bot_port(match, i), to_string(settings.request_timeout_ms).c_str(), to_string(settings.game_threads).c_str());
 	}
 
-	cout << "Starting " << num_players << " instances of sc2 "
-		<< "(timeout " << GAME_TIMEOUT << ")..." << endl;
-	sc2::ParseSettings(argc, argv, process_settings, game_settings);
-	pids.reserve(num_players);
-	for (int i = 0; i < num_players; i++) {
-		pids[i] = sc2::StartProcess(process_settings.process_path, {
-			"-listen", BOT_HOST,
-			"-port", to_string(port++).c_str(),
-			"-displayMode", "0",
-			"-dataVersion", process_settings.data_version });
-		cout << "Starting SC2, PID:" << pids[i]
-			<< ", port:" << port << endl;
-	}
-
-	// Give game 10 sec to start
-	sc2::SleepFor(GAME_TIMEOUT);
+	// Reuses instances left over from earlier matches when it can
+	match.instances = pool->acquire(players);
+	for (Sc2Instance* instance : match.instances)
+		match.sc2_baseline.push_back(instance->group->usage(instance->pid));
+	if (match.instances.size() < players) {
+		LOG_WARN(&match.log, "Could only get " << match.instances.size() << " of "
+			<< players << " sc2 instances");
+		return false;
+	}
+
+	return true;
 }
 
-void Arena::connect_players(int port, string first_map, string proc_path) {
-	// Connect to localhost websocket
-	for (int i = 0; i < num_players; i++) {
-		cout << "Player " << i << ", connecting port:" << port << endl;
-		connections.push_back(new sc2::Connection());
-		connections.back()->Connect(BOT_HOST, port++);
-	}
+bool Arena::connect_players(Match& match) {
+	// The pool has already connected to each instance
+	for (Sc2Instance* instance : match.instances)
+		instance->games++;
 
 	// 2) Designate a host, and Request.create_game with a multiplayer map.
 	sc2::GameRequestPtr req = proto.MakeRequest();
 	SC2APIProtocol::RequestCreateGame* game_request = req->mutable_create_game();
-	resolve_map(game_request, first_map, proc_path);
-	game_request->set_realtime(false);
+	catalog->fill(game_request, match.map);
+	game_request->set_realtime(settings.realtime);
 
-	for (auto const &p : bots) {
+	for (auto const &p : match.bots) {
 		SC2APIProtocol::PlayerSetup* playerSetup = game_request->add_player_setup();
 		playerSetup->set_type(SC2APIProtocol::PlayerType(p.type));
 		playerSetup->set_race(SC2APIProtocol::Race(int(p.race) + 1));
 		playerSetup->set_difficulty(SC2APIProtocol::Difficulty(p.difficulty));
 	}
 
-	connections[0]->Send(req.get());
-	SC2APIProtocol::Response* response_create_game = nullptr;
-	if (connections[0]->Receive(response_create_game, GAME_TIMEOUT)) {
-		auto game_response = response_create_game->create_game();
-		if (game_response.has_error()) {
-			string errorCode = "Unknown";
-			switch (game_response.error()) {
-			case SC2APIProtocol::ResponseCreateGame::MissingMap: errorCode = "Missing Map";
-			case SC2APIProtocol::ResponseCreateGame::InvalidMapPath: errorCode = "Invalid Map Path";
-			case SC2APIProtocol::ResponseCreateGame::InvalidMapData: errorCode = "Invalid Map Data";
-			case SC2APIProtocol::ResponseCreateGame::InvalidMapName: errorCode = "Invalid Map Name";
-			case SC2APIProtocol::ResponseCreateGame::InvalidMapHandle: errorCode = "Invalid Map Handle";
-			case SC2APIProtocol::ResponseCreateGame::MissingPlayerSetup: errorCode = "Missing Player Setup";
-			case SC2APIProtocol::ResponseCreateGame::InvalidPlayerSetup: errorCode = "Invalid Player Setup";
-			}
-
-			cerr << "CreateGame request returned an error code: " << errorCode << endl;
-			if (game_response.has_error_details() && game_response.error_details().length() > 0) {
-				cerr << "CreateGame request returned error details: " << game_response.error_details() << endl;
-			}
-			exit(-1);
+	// The host loads the map while it creates the game
+	SC2APIProtocol::Response response_create_game;
+	auto load_start = chrono::steady_clock::now();
+	bool created = Sc2Pool::call(match.instances[0], *req, response_create_game);
+	match.record.map_load_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - load_start).count();
+	// The match's instances go back to the pool in teardown, which resets
+	// them and retires one that is still busy with this game
+	if (!created) {
+		LOG_ERROR(&match.log, "CreateGame on " << match.map << " failed or got no response in " << match.record.map_load_ms
+			<< "ms on SC2 PID:" << match.instances[0]->pid);
+		return false;
+	}
+	auto game_response = response_create_game.create_game();
+	if (game_response.has_error()) {
+		string errorCode = "Unknown";
+		switch (game_response.error()) {
+		case SC2APIProtocol::ResponseCreateGame::MissingMap: errorCode = "Missing Map"; break;
+		case SC2APIProtocol::ResponseCreateGame::InvalidMapPath: errorCode = "Invalid Map Path"; break;
+		case SC2APIProtocol::ResponseCreateGame::InvalidMapData: errorCode = "Invalid Map Data"; break;
+		case SC2APIProtocol::ResponseCreateGame::InvalidMapName: errorCode = "Invalid Map Name"; break;
+		case SC2APIProtocol::ResponseCreateGame::InvalidMapHandle: errorCode = "Invalid Map Handle"; break;
+		case SC2APIProtocol::ResponseCreateGame::MissingPlayerSetup: errorCode = "Missing Player Setup"; break;
+		case SC2APIProtocol::ResponseCreateGame::InvalidPlayerSetup: errorCode = "Invalid Player Setup"; break;
+		default: break;
 		}
-		else {
-			cout << "Recieved create game response " << response_create_game->data().DebugString() << endl;
+
+		LOG_WARN(&match.log, "CreateGame request returned an error code: " << errorCode);
+		if (game_response.has_error_details() && game_response.error_details().length() > 0) {
+			LOG_WARN(&match.log, "CreateGame request returned error details: " << game_response.error_details());
 		}
+		// Other matches may be running, only this one is lost
+		return false;
+	}
+	else {
+		LOG_INFO(&match.log, "Created game on " << match.map << " in " << match.record.map_load_ms << "ms on SC2 PID:"
+			<< match.instances[0]->pid);
 	}
 	// 3) Call Request.join on BOTH clients.Join will block until both clients connect.
 	// The client take over from here and do coordinator.JoinGame(); themselves
+	return true;
+}
+
+// Win bits from the player_result the relays saw. sc2 reports results
+// by player id, which each relay learned from its join_game response.
+static int get_results(const vector<RelayState>& states) {
+	int res = ArenaResult::None;
+	for (auto const& reporter : states) {
+		if (!reporter.has_results)
+			continue;
+		for (size_t i = 0; i < states.size(); i++) {
+			uint32_t id = states[i].player_id;
+			if (id > 0 && id <= MAX_PLAYERS && reporter.results[id] == SC2APIProtocol::Victory)
+				res |= ArenaResult::Player1Win << i;
+		}
+	}
+
+	return res;
+}
+
+// One event per bot, the summary's lines kept together in it
+static void print_relay_stats(const Bot& bot, const RelayState& state) {
+	if (!ArenaLog::enabled(LogInfo))
+		return;
+
+	ostringstream out;
+	state.metrics.print_summary(out, bot.name);
+	if (state.realtime)
+		state.pacing.print_summary(out);
+	if (state.step_limit.count() > 0)
+		out << "  " << state.overruns << " steps over " << state.step_limit.count()
+			<< "ms, " << state.time_bank.count() << "ms left in time bank" << endl;
+	string summary = out.str();
+	if (!summary.empty() && summary.back() == '\n')
+		summary.pop_back();
+	LOG_INFO(&state.log, summary);
+}
 
+// Steps of every player side by side, to spot slow bots and slow maps
+static void write_latency_series(const Match& match, const vector<RelayState>& states) {
+	if (settings.latency_series_prefix.empty())
+		return;
 
-	
+	vector<const RelayMetrics*> players;
+	for (auto const& s : states)
+		players.push_back(&s.metrics);
+	string path = settings.latency_series_prefix + to_string(match.record.started) + "_" + to_string(match.port_start) + ".csv";
+	if (!write_series(path, players))
+		LOG_WARN(&match.log, "Could not write latency series to " << path);
 }
 
-int get_results(sc2::Connection* con) {
-	return 0;
+// Where this match's bot logs go, "" if bot output is not kept
+static string bot_log_dir(const Match& match) {
+	if (settings.log_dir.empty())
+		return "";
+
+	string dir = settings.log_dir + "/" + to_string(match.record.started) + "_" + to_string(match.port_start);
+	if (!make_dir(settings.log_dir) || !make_dir(dir)) {
+		LOG_WARN(&match.log, "Could not create " << dir << ", bot output is not kept");
+		return "";
+	}
+
+	return dir;
+}
+
+// Returns once every bot has sent join_game, or the crash bits of the
+// bots that did not.
+static int wait_for_joins(Match& match) {
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(settings.join_timeout_ms);
+	int res = ArenaResult::None;
+	for (size_t i = 0; i < match.bots.size(); i++) {
+		// Sliced so a bot that exits on startup fails the match right away
+		while (!match.servers[i]->wait_joined(chrono::milliseconds(250))) {
+			if (proc_exited(match.pids[i])) {
+				LOG_WARN(&match.log, "bot " << match.bots[i].name << " exited before joining");
+				res |= Player1Crash << i;
+				break;
+			}
+			if (chrono::steady_clock::now() > deadline) {
+				LOG_WARN(&match.log, "bot " << match.bots[i].name << " did not join within "
+					<< settings.join_timeout_ms << "ms");
+				res |= Player1Crash << i;
+				break;
+			}
+		}
+	}
+
+	return res;
 }
 
-int Arena::run_bot_bins() {
+int Arena::run_bot_bins(Match& match) {
+	size_t players = match.bots.size();
 	// 4) Wait for a response from both clients.They can now play / step.
 	int res = ArenaResult::None;
-	vector<future<ClientStatus>> threads_tick(num_players);
+	// Outlives the relays, each of which leaves it as it finishes
+	unique_ptr<StepBarrier> lockstep;
+	vector<shared_ptr<Relay>> relays;
+	vector<RelayState> stats(players);
+	MatchSupervisor supervisor;
+	auto wall_start = chrono::steady_clock::now();
+
+	// Start each bot's binary as a subprocess in its own cgroup, pointed
+	// at this match's ports, with its output going to its log
+	string log_dir = bot_log_dir(match);
+	ResourceLimits limits;
+	limits.cpu_percent = settings.bot_cpu_percent;
+	limits.memory_mb = settings.bot_memory_mb;
+	limits.pin_cpu = settings.pin_cpus;
+	match.group = new ResourceGroup("match_" + to_string(match.port_start), ResourceLimits());
+	for (size_t i = 0; i < players; i++) {
+		const Bot& b = match.bots[i];
+		vector<string> args = make_args(match, i);
+		args.insert(args.end(), b.cmd_args.begin(), b.cmd_args.end());
+		match.groups.push_back(new ResourceGroup("bot_" + to_string(match.port_start) + "_" + to_string(i), limits, match.group));
+		int output = -1;
+		if (!log_dir.empty()) {
+			output = LogCapture::instance().open(log_dir + "/" + to_string(i) + "_" + b.name + ".log");
+			LOG_INFO(&match.log, "Player " << i << " logs to " << log_dir << "/" << i << "_" << b.name << ".log");
+		}
+		int pidfd;
+		match.pids.push_back(start_proc(b.path, args, match.groups[i]->path(), output, &pidfd));
+		supervisor.watch_bot(i, match.pids[i], pidfd);
+	}
 
-	// Start each bot's binary as a subprocess
-	for (auto const &b : bots) {
-		pids.push_back(start_proc(b.path, b.cmd_args));
+	vector<unique_ptr<TraceWriter>> traces;
+	for (size_t i = 0; i < players; i++) {
+		const Bot& b = match.bots[i];
+		stats[i].step_limit = chrono::milliseconds(b.step_limit_ms >= 0 ? b.step_limit_ms : settings.step_limit_ms);
+		stats[i].time_bank = chrono::milliseconds(b.time_bank_ms >= 0 ? b.time_bank_ms : settings.time_bank_ms);
+		// The game does not wait for a realtime bot, slow ones just see
+		// less of it, so there is no budget to overrun
+		if (settings.realtime)
+			stats[i].step_limit = chrono::milliseconds(0);
+		stats[i].realtime = settings.realtime;
+		stats[i].log = { match.log.match, b.name };
+		stats[i].bot_timeout = chrono::milliseconds(settings.bot_timeout_ms);
+		stats[i].game_timeout = chrono::milliseconds(settings.game_timeout_ms);
+		stats[i].join_timeout = chrono::milliseconds(settings.join_timeout_ms);
+		stats[i].max_game_loops = uint32_t(settings.max_game_loops);
+		if (!settings.trace_prefix.empty()) {
+			traces.emplace_back(new TraceWriter(settings.trace_prefix + to_string(match.record.started) + "_"
+				+ to_string(match.port_start) + "_" + to_string(i) + ".bin"));
+			stats[i].trace = traces.back().get();
+		}
 	}
 
-	cout << "Giving bots 5s to join..." << endl;
-	this_thread::sleep_for(std::chrono::nanoseconds(5s));
-	cout << "Starting game" << endl;
+	if (settings.lockstep && players > 1) {
+		vector<GameConnection*> connections;
+		for (size_t i = 0; i < players; i++)
+			connections.push_back(match.instances[i]->connection);
+		lockstep.reset(new StepBarrier(connections));
+		for (size_t i = 0; i < players; i++) {
+			stats[i].lockstep = lockstep.get();
+			stats[i].seat = i;
+		}
+	}
 
-	// For each bot make a thread to handle the connection
-	for (int i = 0; i < num_players; i++) {
-		threads_tick[i] = async(&client_tick, connections[i], servers[i]);
+	{
+		lock_guard<mutex> guard(running_lock);
+		match.states = &stats;
 	}
 
-	vector<future_status> statuses_tick(num_players);
-	// Run them until game ends.
-	while (true) {
-		// Wait for first thread
-		statuses_tick[0] = threads_tick[0].wait_for(1s);
-		// Get status of the rest
-		for (unsigned int i = 1; i < threads_tick.size(); i++) {
-			statuses_tick[i] = threads_tick[i].wait_for(0s);
-		}
+	// For each bot a relay on the shared executor handles the connection.
+	// Requests queue up in the server until its relay gets to them.
+	for (size_t i = 0; i < players; i++) {
+		relays.push_back(Relay::start(*executor, match.instances[i]->connection, match.servers[i], &stats[i],
+			[&supervisor, i](ClientStatus status) { supervisor.relay_done(i, status); }));
+	}
 
-		for (unsigned int i = 0; i < statuses_tick.size(); i++) {
-			if (statuses_tick[i] == future_status::ready) {
-				cout << "bot " << bots[i].name << " done" << endl;
-				ClientStatus cs = threads_tick[i].get();
-				switch (cs) {
-				case ClientStatus::ClientTimeout:	res = res | (Player1Crash + (1u << i));
-				case ClientStatus::Quit:			res = res | (Player1Forfeit + (1u << i));
-				case ClientStatus::GameTimeout:		res = res | GameTimeout;
+	vector<bool> done(players, false), exited(players, false);
+	size_t finished = 0;
+	// Cuts off the relays still running and waits until each has said so,
+	// after which none of them touches the match again
+	auto collect_relays = [&]() {
+		for (auto& r : relays)
+			r->cancel();
+		while (finished < players) {
+			MatchEvent event = supervisor.next(chrono::steady_clock::now() + chrono::milliseconds(settings.game_timeout_ms));
+			if (event.kind == MatchEvent::RelayDone && !done[event.player]) {
+				done[event.player] = true;
+				finished++;
+			}
+		}
+		lock_guard<mutex> guard(running_lock);
+		match.states = nullptr;
+	};
+
+	LOG_INFO(&match.log, "Waiting up to " << settings.join_timeout_ms << "ms for bots to join...");
+	int join_res = wait_for_joins(match);
+	if (join_res != ArenaResult::None) {
+		collect_relays();
+		return join_res | ArenaResult::Error;
+	}
+	LOG_INFO(&match.log, "Starting game");
+
+	// Play until every relay has seen the game end, or until something
+	// decides the match early: a bot crashing, quitting or running out of
+	// time, or the match running out of time.
+	auto deadline = wall_start + chrono::milliseconds(settings.match_timeout_ms);
+	bool decided = false;
+	while (finished < players && !decided) {
+		MatchEvent event = supervisor.next(deadline);
+		switch (event.kind) {
+		case MatchEvent::RelayDone:
+			done[event.player] = true;
+			finished++;
+			LOG_INFO(&match.log, "bot " << match.bots[event.player].name << " done");
+			switch (event.status) {
+			case ClientStatus::ClientTimeout:	res |= ArenaResult::Player1Crash << event.player; break;
+			case ClientStatus::Quit:			res |= ArenaResult::Player1Forfeit << event.player; break;
+			case ClientStatus::OutOfTime:		res |= ArenaResult::Player1Forfeit << event.player; break;
+			case ClientStatus::GameTimeout:		res |= ArenaResult::Timeout; break;
+			case ClientStatus::GameError:		res |= ArenaResult::Error; break;
+			default:							break;
+			}
+			if (event.status != ClientStatus::GameEnd) {
+				decided = true;
+				break;
+			}
+			// The other players see the end in their next observation
+			deadline = min(deadline, chrono::steady_clock::now() + chrono::milliseconds(settings.game_timeout_ms));
+			break;
+		case MatchEvent::BotExit:
+			// Its relay is about to see the socket close, give it a moment
+			// to say whether the game had ended first
+			if (!done[event.player]) {
+				exited[event.player] = true;
+				deadline = min(deadline, chrono::steady_clock::now() + chrono::milliseconds(settings.bot_exit_grace_ms));
+			}
+			break;
+		case MatchEvent::Deadline: {
+			decided = true;
+			bool crashed = false;
+			for (size_t i = 0; i < players; i++) {
+				if (exited[i] && !done[i]) {
+					LOG_INFO(&match.log, "bot " << match.bots[i].name << " exited");
+					res |= ArenaResult::Player1Crash << i;
+					crashed = true;
 				}
 			}
-			//if (bot_procs[i].valid() && !bot_procs[i].running()) {
-			//	cout << "bot " << bots[i].name << " crash ";
-			//	cout << "(Exit code: " << bot_procs[i].exit_code() << ")" << endl;
-			//	res = res | (Player1Crash + (1u << i));
-			//	bot_procs[i].terminate(); // Makes invalid.
-			//}
+			if (!crashed) {
+				LOG_INFO(&match.log, "Match timed out");
+				res |= ArenaResult::Timeout;
+			}
+			break;
+		}
 		}
 	}
-	// Get who won
-	res = res | get_results(connections[0]);
+	collect_relays();
+
+	for (size_t i = 0; i < players; i++)
+		print_relay_stats(match.bots[i], stats[i]);
+	if (lockstep) {
+		vector<string> names;
+		for (auto const& b : match.bots)
+			names.push_back(b.name);
+		ostringstream summary;
+		lockstep->print_summary(summary, names);
+		LOG_INFO(&match.log, summary.str());
+	}
+	write_latency_series(match, stats);
 
-	// Cleanup
+	// Get who won
+	res |= get_results(stats);
+	for (auto const& s : stats) {
+		match.record.game_loops = max(match.record.game_loops, s.game_loop.load());
+		match.record.join_ms.push_back(chrono::duration_cast<chrono::milliseconds>(s.join_time).count());
+	}
 
 	return res;
 }
 
-int Arena::play(string map, int argc, char* argv[]) {
+// Asks the host for the replay while the game is still loaded, before
+// the instances go back to the pool.
+bool Arena::save_replay(Match& match) {
+	if (archive == nullptr || match.instances.empty())
+		return false;
+
+	SC2APIProtocol::Request request;
+	request.mutable_save_replay();
+	SC2APIProtocol::Response response;
+	if (!Sc2Pool::call(match.instances[0], request, response) || !response.has_save_replay()) {
+		LOG_WARN(&match.log, "Could not save the replay of " << match.map);
+		return false;
+	}
+
+	archive->add(match.record, response.save_replay().data());
+	return true;
+}
+
+void Arena::record_usage(Match& match) {
+	for (size_t i = 0; i < match.pids.size(); i++)
+		match.record.bot_usage.push_back(match.groups[i]->usage(match.pids[i]));
+	for (size_t i = 0; i < match.instances.size(); i++) {
+		Sc2Instance* instance = match.instances[i];
+		ResourceUsage usage = instance->group->usage(instance->pid);
+		usage.cpu_ms -= min(usage.cpu_ms, match.sc2_baseline[i].cpu_ms);
+		match.record.sc2_usage.push_back(usage);
+	}
+}
+
+void Arena::teardown(Match& match) {
+	for (BotServer* s : match.servers)
+		delete s;
+	// The group takes anything the bot started along with it
+	if (match.group == nullptr || !match.group->kill())
+		for (ResourceGroup* g : match.groups)
+			g->kill();
+	for (uint64_t pid : match.pids) {
+		kill_proc(pid);
+		reap_proc(pid);
+	}
+	for (ResourceGroup* g : match.groups)
+		delete g;
+	delete match.group;
+	match.group = nullptr;
+	// Bots are gone, the instances can be reset for the next match
+	for (Sc2Instance* instance : match.instances)
+		pool->release(instance);
+
+	// Last, so no new match gets these ports while anything still uses them
+	if (match.port_start != 0)
+		ports->release(match.port_start);
+
+	match.servers.clear();
+	match.pids.clear();
+	match.groups.clear();
+	match.instances.clear();
+	match.sc2_baseline.clear();
+	match.port_start = 0;
+}
+
+int Arena::play(Match& match) {
 	// Follow the instructions...
 	// https://github.com/Blizzard/s2client-proto/blob/master/s2clientprotocol/sc2api.proto
+	{
+		lock_guard<mutex> guard(running_lock);
+		running.push_back(&match);
+	}
 
-	start_sc2(PORT_P1, argc, argv);
-	connect_players(int(PORT_P1 + bots.size()), map, process_settings.process_path);
+	match.record = MatchRecord();
+	match.record.map = match.map;
+	for (auto const& b : match.bots)
+		match.record.players.push_back(b.name);
+	match.record.started = time(nullptr);
+	auto start = chrono::steady_clock::now();
+
+	int res = ArenaResult::Error;
+	match.port_start = ports->lease(match_ports(match.bots.size()));
+	match.log.match = to_string(match.record.started) + "_" + to_string(match.port_start);
+	if (match.port_start == 0)
+		LOG_ERROR(&match.log, "No block of " << match_ports(match.bots.size()) << " free ports for a match on " << match.map);
+	else if (start_sc2(match) && connect_players(match))
+		res = run_bot_bins(match);
+
+	match.record.result = res;
+	match.record.duration_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+	for (size_t i = 0; i < match.bots.size(); i++) {
+		match.record.outcomes.push_back(player_outcome(res, i, match.bots.size()));
+		if (res & (ArenaResult::Player1Win << i))
+			match.record.winner = int(i);
+	}
+	// Only games that got going have anything to replay
+	if (!(res & ArenaResult::Error))
+		save_replay(match);
 
-	return run_bot_bins();
-}
+	{
+		lock_guard<mutex> guard(running_lock);
+		running.erase(find(running.begin(), running.end(), &match));
+	}
+	record_usage(match);
+	teardown(match);
+
+	LOG_INFO(&match.log, "Match on " << match.map << " took " << match.record.duration_ms << "ms, "
+		<< match.record.game_loops << " game loops, winner: "
+		<< (match.record.winner >= 0 ? match.bots[match.record.winner].name : "none")
+		<< ", map loaded in " << match.record.map_load_ms << "ms");
+	for (size_t i = 0; i < match.record.bot_usage.size(); i++) {
+		LogContext player = { match.log.match, match.bots[i].name };
+		LOG_INFO(&player, (i < match.record.join_ms.size() ? to_string(match.record.join_ms[i]) + "ms to join, " : "")
+			<< match.record.bot_usage[i].cpu_ms << "ms CPU, "
+			<< match.record.bot_usage[i].peak_rss_kb / 1024 << "MB peak"
+			<< (i < match.record.sc2_usage.size() ? ", sc2 " + to_string(match.record.sc2_usage[i].cpu_ms) + "ms CPU, "
+				+ to_string(match.record.sc2_usage[i].peak_rss_kb / 1024) + "MB peak" : ""));
+	}
 
-//bool Arena::kill_procs() {
-//	bool res = true;
-//	for (uint64_t pid : pids)
-//		if (!kill_proc(pid))
-//			res = false;
-//
-//	return res;
-//};
-//
-//void Arena::sig_handler() {
-//	if (!kill_procs())
-//		cout << "Failed to kill some subprocess" << endl;
-//	else
-//		cout << "Killed all subprocesses" << endl;
-//
-//	exit(1);
-//};
+	return res;
+}
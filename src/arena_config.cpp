@@ -0,0 +1,342 @@
+#include <arena_config.h>
+#include <arena.h>
+#include <arena_log.h>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+using namespace std;
+
+ArenaSettings settings;
+
+struct IntOption {
+	const char* key;
+	int ArenaSettings::* field;
+	int min;
+	int max;
+};
+
+static const IntOption int_options[] = {
+	{ "request_timeout_ms", &ArenaSettings::request_timeout_ms, 1, INT_MAX },
+	{ "game_timeout_ms", &ArenaSettings::game_timeout_ms, 1, INT_MAX },
+	{ "bot_timeout_ms", &ArenaSettings::bot_timeout_ms, 1, INT_MAX },
+	{ "join_timeout_ms", &ArenaSettings::join_timeout_ms, 1, INT_MAX },
+	{ "sc2_start_timeout_ms", &ArenaSettings::sc2_start_timeout_ms, 1, INT_MAX },
+	{ "match_timeout_ms", &ArenaSettings::match_timeout_ms, 1, INT_MAX },
+	{ "bot_exit_grace_ms", &ArenaSettings::bot_exit_grace_ms, 0, INT_MAX },
+	{ "max_game_loops", &ArenaSettings::max_game_loops, 1, INT_MAX },
+	{ "step_limit_ms", &ArenaSettings::step_limit_ms, 0, INT_MAX },
+	{ "time_bank_ms", &ArenaSettings::time_bank_ms, 0, INT_MAX },
+	{ "game_threads", &ArenaSettings::game_threads, 1, 64 },
+	{ "relay_threads", &ArenaSettings::relay_threads, 0, 1024 },
+	{ "port_first", &ArenaSettings::port_first, 1024, 65535 },
+	{ "port_last", &ArenaSettings::port_last, 1024, 65535 },
+	{ "sc2_pool_size", &ArenaSettings::sc2_pool_size, 2, 4096 },
+	{ "sc2_max_games", &ArenaSettings::sc2_max_games, 1, INT_MAX },
+	{ "sc2_memory_mb", &ArenaSettings::sc2_memory_mb, 1, INT_MAX },
+	{ "bot_cpu_percent", &ArenaSettings::bot_cpu_percent, 0, 100 * 1024 },
+	{ "bot_memory_mb", &ArenaSettings::bot_memory_mb, 0, INT_MAX },
+	{ "sc2_cpu_percent", &ArenaSettings::sc2_cpu_percent, 0, 100 * 1024 },
+	{ "sc2_memory_limit_mb", &ArenaSettings::sc2_memory_limit_mb, 0, INT_MAX },
+	{ "log_rotate_bytes", &ArenaSettings::log_rotate_bytes, 1024, INT_MAX },
+	{ "log_rotate_keep", &ArenaSettings::log_rotate_keep, 0, 100 },
+	{ "metrics_port", &ArenaSettings::metrics_port, 0, 65535 },
+};
+
+struct StringOption {
+	const char* key;
+	string ArenaSettings::* field;
+};
+
+static const StringOption string_options[] = {
+	{ "cgroup_root", &ArenaSettings::cgroup_root },
+	{ "map_delivery", &ArenaSettings::map_delivery },
+	{ "map_stage_dir", &ArenaSettings::map_stage_dir },
+	{ "log_dir", &ArenaSettings::log_dir },
+	{ "trace_prefix", &ArenaSettings::trace_prefix },
+	{ "latency_series_prefix", &ArenaSettings::latency_series_prefix },
+	{ "log_level", &ArenaSettings::log_level },
+	{ "log_format", &ArenaSettings::log_format },
+	{ "log_file", &ArenaSettings::log_file },
+};
+
+static string trim(const string& s) {
+	size_t start = s.find_first_not_of(" \t\r\n");
+	if (start == string::npos)
+		return "";
+	size_t end = s.find_last_not_of(" \t\r\n");
+	return s.substr(start, end - start + 1);
+}
+
+static string lower(string s) {
+	for (char& c : s)
+		c = char(tolower((unsigned char)c));
+	return s;
+}
+
+static vector<string> split_words(const string& s) {
+	vector<string> res;
+	istringstream in(s);
+	string word;
+	while (in >> word)
+		res.push_back(word);
+
+	return res;
+}
+
+static bool parse_int(const string& value, int min, int max, int& out, string& error) {
+	errno = 0;
+	char* end;
+	long v = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0' || errno == ERANGE || v < min || v > max) {
+		error = "expected a whole number from " + to_string(min) + " to " + to_string(max) + ", got \"" + value + "\"";
+		return false;
+	}
+
+	out = int(v);
+	return true;
+}
+
+static bool parse_bool(const string& value, bool& out, string& error) {
+	string v = lower(value);
+	if (v == "1" || v == "true" || v == "yes" || v == "on")
+		out = true;
+	else if (v == "0" || v == "false" || v == "no" || v == "off")
+		out = false;
+	else {
+		error = "expected true or false, got \"" + value + "\"";
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_race(const string& value, sc2::Race& out, string& error) {
+	string v = lower(value);
+	if (v == "terran") out = sc2::Race::Terran;
+	else if (v == "zerg") out = sc2::Race::Zerg;
+	else if (v == "protoss") out = sc2::Race::Protoss;
+	else if (v == "random") out = sc2::Race::Random;
+	else {
+		error = "unknown race \"" + value + "\"";
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_difficulty(const string& value, sc2::Difficulty& out, string& error) {
+	static const char* names[] = { "veryeasy", "easy", "medium", "mediumhard", "hard",
+		"hardveryhard", "veryhard", "cheatvision", "cheatmoney", "cheatinsane" };
+	string v = lower(value);
+	for (int i = 0; i < 10; i++) {
+		if (v == names[i]) {
+			out = sc2::Difficulty(int(sc2::Difficulty::VeryEasy) + i);
+			return true;
+		}
+	}
+
+	error = "unknown difficulty \"" + value + "\"";
+	return false;
+}
+
+bool set_option(ArenaConfig& config, const string& key, const string& value, string& error) {
+	if (key == "sc2")
+		config.sc2_path = value;
+	else if (key == "sc2_args")
+		config.sc2_args = split_words(value);
+	else if (key == "map")
+		config.maps.push_back(value);
+	else if (key == "tournament") {
+		string v = lower(value);
+		if (v == "round_robin")
+			config.tournament = TournamentType::RoundRobin;
+		else if (v == "single_elim")
+			config.tournament = TournamentType::SingleElim;
+		else if (v == "double_elim")
+			config.tournament = TournamentType::DoubleElim;
+		else {
+			error = "unknown tournament \"" + value + "\", expected round_robin, single_elim or double_elim";
+			return false;
+		}
+	}
+	else if (key == "concurrency")
+		return parse_int(value, 0, 4096, config.concurrency, error);
+	else if (key == "results")
+		config.results_path = value;
+	else if (key == "replays")
+		config.replay_dir = value;
+	else if (key == "checkpoint")
+		config.checkpoint_path = value;
+	else if (key == "pin_cpus")
+		return parse_bool(value, config.settings.pin_cpus, error);
+	else if (key == "lockstep")
+		return parse_bool(value, config.settings.lockstep, error);
+	else if (key == "realtime")
+		return parse_bool(value, config.settings.realtime, error);
+	else {
+		for (auto const& o : int_options)
+			if (key == o.key)
+				return parse_int(value, o.min, o.max, config.settings.*o.field, error);
+		for (auto const& o : string_options) {
+			if (key == o.key) {
+				config.settings.*o.field = value;
+				return true;
+			}
+		}
+
+		error = "unknown key \"" + key + "\"";
+		return false;
+	}
+
+	return true;
+}
+
+static bool set_bot_option(Bot& bot, const string& key, const string& value, string& error) {
+	if (key == "name")
+		bot.name = value;
+	else if (key == "path")
+		bot.path = value;
+	else if (key == "args")
+		bot.cmd_args = split_words(value);
+	else if (key == "race")
+		return parse_race(value, bot.race, error);
+	else if (key == "type") {
+		string v = lower(value);
+		if (v == "participant")
+			bot.type = sc2::PlayerType::Participant;
+		else if (v == "computer")
+			bot.type = sc2::PlayerType::Computer;
+		else {
+			error = "unknown bot type \"" + value + "\", expected participant or computer";
+			return false;
+		}
+	}
+	else if (key == "difficulty")
+		return parse_difficulty(value, bot.difficulty, error);
+	else if (key == "step_limit_ms")
+		return parse_int(value, 0, INT_MAX, bot.step_limit_ms, error);
+	else if (key == "time_bank_ms")
+		return parse_int(value, 0, INT_MAX, bot.time_bank_ms, error);
+	else {
+		error = "unknown bot key \"" + key + "\"";
+		return false;
+	}
+
+	return true;
+}
+
+bool load_config(const string& path, ArenaConfig& config, vector<string>& errors) {
+	ifstream in(path);
+	if (!in) {
+		errors.push_back("Could not read config " + path);
+		return false;
+	}
+
+	size_t errors_before = errors.size();
+	Bot* bot = nullptr;
+	string line;
+	for (int number = 1; getline(in, line); number++) {
+		// A # after whitespace starts a comment, one inside a value does not
+		for (size_t i = 1; i < line.size(); i++) {
+			if (line[i] == '#' && (line[i - 1] == ' ' || line[i - 1] == '\t')) {
+				line.erase(i);
+				break;
+			}
+		}
+		line = trim(line);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		string where = path + ":" + to_string(number) + ": ";
+		if (line[0] == '[') {
+			if (lower(line) != "[bot]") {
+				errors.push_back(where + "unknown section " + line);
+				continue;
+			}
+			Bot b;
+			b.type = sc2::PlayerType::Participant;
+			b.race = sc2::Race::Random;
+			b.difficulty = sc2::Difficulty::Easy;
+			b.seed = 0;
+			config.bots.push_back(b);
+			bot = &config.bots.back();
+			continue;
+		}
+
+		size_t eq = line.find('=');
+		if (eq == string::npos) {
+			errors.push_back(where + "expected key = value");
+			continue;
+		}
+		string key = trim(line.substr(0, eq));
+		string value = trim(line.substr(eq + 1));
+		string error;
+		if (!(bot != nullptr ? set_bot_option(*bot, key, value, error) : set_option(config, key, value, error)))
+			errors.push_back(where + error);
+	}
+
+	return errors.size() == errors_before;
+}
+
+vector<string> validate_config(const ArenaConfig& config) {
+	vector<string> errors;
+	const ArenaSettings& s = config.settings;
+	const string& sc2 = Arena::process_settings.process_path;
+	if (sc2.empty())
+		errors.push_back("No sc2 binary, set sc2 in the config or pass -e");
+	else if (!sc2::DoesFileExist(sc2))
+		errors.push_back("sc2 binary " + sc2 + " does not exist");
+
+	if (config.bots.size() < 2)
+		errors.push_back("A tournament needs at least 2 bots, the config has " + to_string(config.bots.size()));
+	set<string> names;
+	for (size_t i = 0; i < config.bots.size(); i++) {
+		const Bot& b = config.bots[i];
+		string which = "Bot " + to_string(i + 1) + (b.name.empty() ? "" : " (" + b.name + ")");
+		// Names key the results database and name the bot's log file
+		if (b.name.empty())
+			errors.push_back(which + " has no name");
+		else if (b.name.find_first_of("/\\") != string::npos)
+			errors.push_back(which + " has a / or \\ in its name");
+		else if (!names.insert(b.name).second)
+			errors.push_back(which + " has the same name as another bot");
+		// A computer bot too is a binary, told to play sc2's AI
+		if (b.path.empty())
+			errors.push_back(which + " has no path");
+		else if (!sc2::DoesFileExist(b.path))
+			errors.push_back(which + " binary " + b.path + " does not exist");
+	}
+
+	if (config.maps.empty())
+		errors.push_back("No maps, add a map = line");
+	for (auto const& m : config.maps) {
+		SC2APIProtocol::RequestCreateGame request;
+		if (!Arena::resolve_map(&request, m, sc2))
+			errors.push_back("Map " + m + " is not in sc2's maps directory or the library, and is not a path");
+	}
+	MapDelivery delivery;
+	if (!MapCatalog::parse_delivery(s.map_delivery, delivery))
+		errors.push_back("Unknown map_delivery \"" + s.map_delivery + "\", expected path, inline or stage");
+
+	// The smallest match block plus an sc2 instance per player
+	if (s.port_last - s.port_first + 1 < int(Arena::match_ports(2)) + 2)
+		errors.push_back("port_first to port_last leaves too few ports for even one match");
+	LogLevel level;
+	if (!ArenaLog::parse_level(s.log_level, level))
+		errors.push_back("Unknown log_level \"" + s.log_level + "\", expected debug, info, warn, error or off");
+	LogFormat format;
+	if (!ArenaLog::parse_format(s.log_format, format))
+		errors.push_back("Unknown log_format \"" + s.log_format + "\", expected json or text");
+
+	// A realtime sc2 does not wait for steps, there are none to hold
+	if (s.realtime && s.lockstep)
+		errors.push_back("realtime and lockstep cannot both be on");
+	if (s.sc2_pool_size < 2)
+		errors.push_back("sc2_pool_size is too small for a 2 player match");
+
+	return errors;
+}
@@ -0,0 +1,209 @@
+#include <arena_log.h>
+#include <chrono>
+#include <time.h>
+
+using namespace std;
+
+static const char* level_names[] = { "debug", "info", "warn", "error", "off" };
+
+atomic<int> ArenaLog::threshold(LogInfo);
+
+// Never destroyed: threads the arena does not join, civetweb's among
+// them, may still log while statics are torn down at exit
+ArenaLog& ArenaLog::instance() {
+	static ArenaLog* log = new ArenaLog();
+	return *log;
+}
+
+ArenaLog::ArenaLog() : slots(new Slot[LOG_RING_SIZE]) {
+	for (size_t i = 0; i < LOG_RING_SIZE; i++)
+		slots[i].sequence.store(i, memory_order_relaxed);
+	thread(&ArenaLog::run, this).detach();
+}
+
+bool ArenaLog::parse_level(const string& name, LogLevel& level) {
+	for (int i = LogDebug; i <= LogOff; i++) {
+		if (name == level_names[i]) {
+			level = LogLevel(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ArenaLog::parse_format(const string& name, LogFormat& format) {
+	if (name == "json")
+		format = LogJson;
+	else if (name == "text")
+		format = LogText;
+	else
+		return false;
+	return true;
+}
+
+bool ArenaLog::open(const string& path, LogFormat format) {
+	FILE* file = stdout;
+	if (!path.empty()) {
+		file = fopen(path.c_str(), "ab");
+		if (file == nullptr)
+			return false;
+	}
+
+	flush();
+	lock_guard<mutex> guard(sink_lock);
+	if (sink != stdout)
+		fclose(sink);
+	sink = file;
+	style = format;
+	return true;
+}
+
+// A bounded multi-producer queue: each slot's sequence says whose turn
+// it is, so producers claim a slot with one compare-and-swap on tail and
+// the flusher takes slots in order without any lock.
+void ArenaLog::write(LogLevel level, const LogContext* context, string& message) {
+	size_t pos = tail.load(memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &slots[pos % LOG_RING_SIZE];
+		size_t sequence = slot->sequence.load(memory_order_acquire);
+		intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+		if (diff == 0) {
+			if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			// A lap behind: the flusher has not freed this slot yet
+			lost.fetch_add(1, memory_order_relaxed);
+			return;
+		}
+		else {
+			pos = tail.load(memory_order_relaxed);
+		}
+	}
+
+	slot->level = level;
+	slot->time_us = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	// Assigned rather than moved so the slots' buffers are reused
+	if (context != nullptr) {
+		slot->match.assign(context->match);
+		slot->bot.assign(context->bot);
+	}
+	else {
+		slot->match.clear();
+		slot->bot.clear();
+	}
+	slot->message.swap(message);
+	slot->sequence.store(pos + 1, memory_order_release);
+}
+
+void ArenaLog::flush() {
+	size_t target = tail.load(memory_order_acquire);
+	while (done.load(memory_order_acquire) < target)
+		this_thread::sleep_for(chrono::milliseconds(1));
+}
+
+void ArenaLog::run() {
+	while (true) {
+		if (!drain())
+			this_thread::sleep_for(chrono::milliseconds(LOG_FLUSH_MS));
+	}
+}
+
+bool ArenaLog::drain() {
+	lock_guard<mutex> guard(sink_lock);
+	bool any = false;
+	while (true) {
+		Slot& slot = slots[head % LOG_RING_SIZE];
+		if (slot.sequence.load(memory_order_acquire) != head + 1)
+			break;
+
+		format(slot.level, slot.time_us, slot.match, slot.bot, slot.message);
+		fwrite(line.data(), 1, line.size(), sink);
+		slot.message.clear();
+		slot.sequence.store(head + LOG_RING_SIZE, memory_order_release);
+		head++;
+		done.store(head, memory_order_release);
+		any = true;
+	}
+
+	uint64_t missed = lost.exchange(0, memory_order_relaxed);
+	if (missed > 0) {
+		string message = to_string(missed) + " log events dropped, the log could not keep up";
+		format(LogWarn, chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count(),
+			"", "", message);
+		fwrite(line.data(), 1, line.size(), sink);
+		any = true;
+	}
+	if (any)
+		fflush(sink);
+	return any;
+}
+
+static void append_json(string& out, const string& s) {
+	out += '"';
+	for (unsigned char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out += escaped;
+			}
+			else
+				out += char(c);
+		}
+	}
+	out += '"';
+}
+
+// Into line, ending in a newline
+void ArenaLog::format(LogLevel level, int64_t time_us, const string& match, const string& bot, const string& message) {
+	time_t seconds = time_t(time_us / 1000000);
+	struct tm utc;
+#ifdef _WIN32
+	gmtime_s(&utc, &seconds);
+#else
+	gmtime_r(&seconds, &utc);
+#endif
+	char stamp[40];
+	size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+	snprintf(stamp + n, sizeof(stamp) - n, ".%03dZ", int(time_us / 1000 % 1000));
+
+	line.clear();
+	if (style == LogText) {
+		line += stamp;
+		line += " ";
+		line += level_names[level];
+		if (!match.empty())
+			line += " [" + match + "]";
+		if (!bot.empty())
+			line += " " + bot + ":";
+		line += " ";
+		line += message;
+		line += '\n';
+		return;
+	}
+
+	line += "{\"time\":\"";
+	line += stamp;
+	line += "\",\"level\":\"";
+	line += level_names[level];
+	line += '"';
+	if (!match.empty()) {
+		line += ",\"match\":";
+		append_json(line, match);
+	}
+	if (!bot.empty()) {
+		line += ",\"bot\":";
+		append_json(line, bot);
+	}
+	line += ",\"msg\":";
+	append_json(line, message);
+	line += "}\n";
+}
@@ -0,0 +1,122 @@
+#include <bot_server.h>
+#include <arena_log.h>
+#include <civetweb.h>
+#include <wire_peek.h>
+#include <cstring>
+
+using namespace std;
+
+BotServer::~BotServer() {
+	stop();
+}
+
+bool BotServer::listen(int port, const char* request_timeout, const char* threads) {
+	string ports = to_string(port);
+	const char* options[] = {
+		"listening_ports", ports.c_str(),
+		"request_timeout_ms", request_timeout,
+		"websocket_timeout_ms", request_timeout,
+		"num_threads", threads,
+		nullptr
+	};
+
+	mg_callbacks callbacks;
+	memset(&callbacks, 0, sizeof(callbacks));
+	context = mg_start(&callbacks, this, options);
+	if (context == nullptr) {
+		LOG_ERROR(nullptr, "Could not listen on port " << port);
+		return false;
+	}
+
+	mg_set_websocket_handler(context, "/sc2api", &on_connect, &on_ready, &on_data, &on_close, this);
+	return true;
+}
+
+void BotServer::stop() {
+	if (context != nullptr) {
+		mg_stop(context);
+		context = nullptr;
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		connection = nullptr;
+	}
+	requests.clear();
+	requests.close();
+}
+
+bool BotServer::wait_request(string& request, chrono::milliseconds timeout) {
+	return requests.wait_pop(request, timeout);
+}
+
+bool BotServer::send(const string& response) {
+	lock_guard<mutex> guard(lock);
+	if (connection == nullptr)
+		return false;
+
+	return mg_websocket_write(connection, WEBSOCKET_OPCODE_BINARY, response.data(), response.size()) > 0;
+}
+
+bool BotServer::send(const SC2APIProtocol::Response& response) {
+	// Reused so serializing allocates only when a message outgrows it
+	thread_local string buffer;
+	if (!response.SerializeToString(&buffer))
+		return false;
+
+	return send(buffer);
+}
+
+bool BotServer::connected() {
+	lock_guard<mutex> guard(lock);
+	return connection != nullptr;
+}
+
+bool BotServer::wait_joined(chrono::milliseconds timeout) {
+	unique_lock<mutex> guard(lock);
+	return join_arrived.wait_for(guard, timeout, [this] { return joined; });
+}
+
+int BotServer::on_connect(const mg_connection* conn, void* user) {
+	BotServer* s = static_cast<BotServer*>(user);
+	lock_guard<mutex> guard(s->lock);
+	// One bot per server, refuse anyone else
+	return s->connection != nullptr ? 1 : 0;
+}
+
+void BotServer::on_ready(mg_connection* conn, void* user) {
+	BotServer* s = static_cast<BotServer*>(user);
+	lock_guard<mutex> guard(s->lock);
+	s->connection = conn;
+	s->requests.open();
+}
+
+int BotServer::on_data(mg_connection* conn, int bits, char* data, size_t len, void* user) {
+	BotServer* s = static_cast<BotServer*>(user);
+	int opcode = bits & 0x0f;
+	if (opcode == WEBSOCKET_OPCODE_CONNECTION_CLOSE)
+		return 0;
+	if (opcode != WEBSOCKET_OPCODE_BINARY)
+		return 1;
+
+	if (peek_request(data, len) == SC2APIProtocol::Request::kJoinGame) {
+		{
+			lock_guard<mutex> guard(s->lock);
+			s->joined = true;
+		}
+		s->join_arrived.notify_all();
+	}
+	s->requests.push(data, len);
+	return 1;
+}
+
+void BotServer::on_close(const mg_connection* conn, void* user) {
+	BotServer* s = static_cast<BotServer*>(user);
+	{
+		lock_guard<mutex> guard(s->lock);
+		if (s->connection != conn)
+			return;
+		s->connection = nullptr;
+	}
+	s->requests.close();
+}
@@ -0,0 +1,99 @@
+#include <game_connection.h>
+#include <arena_log.h>
+#include <civetweb.h>
+
+using namespace std;
+
+GameConnection::~GameConnection() {
+	disconnect();
+}
+
+bool GameConnection::connect(const char* host, int port, bool verbose) {
+	char error[256] = { 0 };
+	mg_connection* conn = mg_connect_websocket_client(host, port, 0, error, sizeof(error),
+		"/sc2api", nullptr, &on_data, &on_close, this);
+	if (conn == nullptr) {
+		if (verbose)
+			LOG_WARN(nullptr, "Could not connect to " << host << ":" << port << " " << error);
+		return false;
+	}
+
+	lock_guard<mutex> guard(lock);
+	if (connection != nullptr)
+		mg_close_connection(connection);
+	connection = conn;
+	closed = false;
+	responses.open();
+	return true;
+}
+
+void GameConnection::disconnect() {
+	mg_connection* conn;
+	{
+		lock_guard<mutex> guard(lock);
+		conn = connection;
+		connection = nullptr;
+	}
+	if (conn != nullptr)
+		mg_close_connection(conn);
+
+	responses.clear();
+	responses.close();
+}
+
+bool GameConnection::connected() {
+	lock_guard<mutex> guard(lock);
+	return connection != nullptr && !closed;
+}
+
+bool GameConnection::send(const string& request) {
+	lock_guard<mutex> guard(lock);
+	if (connection == nullptr || closed)
+		return false;
+
+	return mg_websocket_client_write(connection, WEBSOCKET_OPCODE_BINARY, request.data(), request.size()) > 0;
+}
+
+bool GameConnection::send(const SC2APIProtocol::Request& request) {
+	// Reused so serializing allocates only when a message outgrows it
+	thread_local string buffer;
+	if (!request.SerializeToString(&buffer))
+		return false;
+
+	return send(buffer);
+}
+
+bool GameConnection::wait_response(string& response, chrono::milliseconds timeout) {
+	return responses.wait_pop(response, timeout);
+}
+
+bool GameConnection::receive(SC2APIProtocol::Response& response, chrono::milliseconds timeout) {
+	thread_local string buffer;
+	if (!wait_response(buffer, timeout))
+		return false;
+
+	return response.ParseFromString(buffer);
+}
+
+int GameConnection::on_data(mg_connection* conn, int bits, char* data, size_t len, void* user) {
+	GameConnection* c = static_cast<GameConnection*>(user);
+	int opcode = bits & 0x0f;
+	if (opcode == WEBSOCKET_OPCODE_CONNECTION_CLOSE)
+		return 0;
+	if (opcode == WEBSOCKET_OPCODE_BINARY)
+		c->responses.push(data, len);
+
+	return 1;
+}
+
+void GameConnection::on_close(const mg_connection* conn, void* user) {
+	GameConnection* c = static_cast<GameConnection*>(user);
+	{
+		lock_guard<mutex> guard(c->lock);
+		if (c->connection != conn)
+			return;
+		// The connection itself is freed in disconnect
+		c->closed = true;
+	}
+	c->responses.close();
+}
@@ -0,0 +1,168 @@
+#include <log_capture.h>
+#include <arena_log.h>
+#include <arena_settings.h>
+#include <cstdio>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#define LOG_READ_SIZE (64 * 1024)
+
+RotatingLog::RotatingLog(const string& path) : path(path) {
+	out.open(path, ios::binary | ios::app);
+	out.seekp(0, ios::end);
+	written = size_t(out.tellp());
+}
+
+void RotatingLog::write(const char* data, size_t len) {
+	if (written > 0 && written + len > size_t(settings.log_rotate_bytes))
+		rotate();
+
+	out.write(data, len);
+	written += len;
+}
+
+void RotatingLog::rotate() {
+	out.close();
+	int keep = settings.log_rotate_keep;
+	remove((path + "." + to_string(keep)).c_str());
+	for (int i = keep - 1; i > 0; i--)
+		rename((path + "." + to_string(i)).c_str(), (path + "." + to_string(i + 1)).c_str());
+	if (keep > 0)
+		rename(path.c_str(), (path + ".1").c_str());
+
+	out.open(path, ios::binary | ios::trunc);
+	written = 0;
+}
+
+LogCapture& LogCapture::instance() {
+	static LogCapture capture;
+	return capture;
+}
+
+#ifdef _WIN32
+LogCapture::LogCapture() {
+}
+
+LogCapture::~LogCapture() {
+}
+
+int LogCapture::open(const string& path) {
+	return -1;
+}
+#else
+LogCapture::LogCapture() {
+	if (pipe(wake_pipe) == 0) {
+		fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+	}
+	reader = thread(&LogCapture::run, this);
+}
+
+LogCapture::~LogCapture() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake();
+	reader.join();
+
+	for (auto& l : logs) {
+		close(l.first);
+		delete l.second;
+	}
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+}
+
+void LogCapture::wake() {
+	char c = 0;
+	if (::write(wake_pipe[1], &c, 1) < 0) {
+		// Full, the reader is waking anyway
+	}
+}
+
+int LogCapture::open(const string& path) {
+	RotatingLog* log = new RotatingLog(path);
+	int fds[2];
+	// Close on exec keeps other children from holding the write end open
+	// and the log from ever seeing the end of the output
+#ifdef __linux__
+	bool opened = pipe2(fds, O_CLOEXEC) == 0;
+#else
+	bool opened = pipe(fds) == 0 && fcntl(fds[0], F_SETFD, FD_CLOEXEC) == 0 && fcntl(fds[1], F_SETFD, FD_CLOEXEC) == 0;
+#endif
+	if (!opened) {
+		LOG_WARN(nullptr, "Could not capture output to " << path);
+		delete log;
+		return -1;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	{
+		lock_guard<mutex> guard(lock);
+		logs[fds[0]] = log;
+	}
+	wake();
+
+	return fds[1];
+}
+
+void LogCapture::run() {
+	vector<pollfd> fds;
+	vector<char> buffer(LOG_READ_SIZE);
+	while (true) {
+		fds.assign(1, { wake_pipe[0], POLLIN, 0 });
+		{
+			lock_guard<mutex> guard(lock);
+			if (stopping)
+				return;
+			for (auto& l : logs)
+				fds.push_back({ l.first, POLLIN, 0 });
+		}
+
+		poll(fds.data(), fds.size(), -1);
+		char drain[64];
+		while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+		}
+
+		// Only this thread removes logs, the ones polled are still there
+		for (size_t i = 1; i < fds.size(); i++) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			RotatingLog* log;
+			{
+				lock_guard<mutex> guard(lock);
+				log = logs[fds[i].fd];
+			}
+			// One read per round, so a bot that never stops printing cannot
+			// hold up the others
+			ssize_t n = read(fds[i].fd, buffer.data(), buffer.size());
+			if (n > 0) {
+				log->write(buffer.data(), size_t(n));
+				log->flush();
+			}
+
+			// Everything holding the write end has exited, or the pipe is
+			// broken. Forgotten before the close, as another thread may be
+			// handed the same fd the moment it is closed.
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+				{
+					lock_guard<mutex> guard(lock);
+					logs.erase(fds[i].fd);
+				}
+				close(fds[i].fd);
+				delete log;
+			}
+		}
+	}
+}
+#endif
@@ -1,104 +1,126 @@
 #include <arena.h>
+#include <arena_config.h>
+#include <arena_log.h>
+#include <arena_settings.h>
+#include <memory>
+#include <metrics_server.h>
 #include <tournament.h>
+#include <scheduler.h>
 
 using namespace std;
 
-static string race_string(sc2::Race race) {
-	switch (race) {
-	case sc2::Race::Protoss:	return "Protoss";
-	case sc2::Race::Random:		return "Random";
-	case sc2::Race::Terran:		return "Terran";
-	case sc2::Race::Zerg:		return "Zerg";
-	default:					return "Random";
-	}
-}
-
-static string difficulty_string(sc2::Difficulty InDifficulty)
-{
-	switch (InDifficulty) {
-	case sc2::Difficulty::VeryEasy:		return "VeryEasy";
-	case sc2::Difficulty::Easy:			return "Easy";
-	case sc2::Difficulty::Medium:		return "Medium";
-	case sc2::Difficulty::MediumHard:	return "MediumHard";
-	case sc2::Difficulty::Hard:			return "Hard";
-	case sc2::Difficulty::HardVeryHard:	return "HardVeryHard";
-	case sc2::Difficulty::VeryHard:		return "VeryHard";
-	case sc2::Difficulty::CheatVision:	return "CheatVision";
-	case sc2::Difficulty::CheatMoney:	return "CheatMoney";
-	case sc2::Difficulty::CheatInsane:	return "CheatInsane";
-	default:							return "Easy";
-	}
+static void usage() {
+	cerr << "usage: sc2arena [-c config] [--set key=value]... [--check] [sc2 options]" << endl
+		<< "  -c, --config   config file, default sc2arena.conf" << endl
+		<< "  --set          overrides a top level config key" << endl
+		<< "  --check        validates the config and exits" << endl
+		<< "  sc2 options, such as -e <sc2 binary>, go to the s2client-api" << endl;
 }
 
-static string result_string(ArenaResult res) {
-	if (res & ArenaResult::Error) return "Error";
+int main(int argc, char* argv[]) {
+	// First, so that every thread started later leaves SIGINT to the one
+	// that runs Arena::sig_handler
+	register_handler((void*)&Arena::sig_handler);
 
-	string msg = "";
-	if (res & ArenaResult::Timeout) {
-		msg += "Timeout\n";
-	}
-	for (int i = ArenaResult::Player1Crash; i <= ArenaResult::Player8Crash; i++) {
-		if (res & i) {
-			msg += "Player" + to_string(i) + "Crash\n";
+	string config_path = "sc2arena.conf";
+	vector<pair<string, string>> overrides;
+	bool check_only = false;
+	// Anything that is not ours is left for sc2::ParseSettings
+	vector<char*> sc2_argv = { argv[0] };
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if ((arg == "-c" || arg == "--config") && i + 1 < argc)
+			config_path = argv[++i];
+		else if (arg == "--set" && i + 1 < argc) {
+			string option = argv[++i];
+			size_t eq = option.find('=');
+			if (eq == string::npos) {
+				usage();
+				return 1;
+			}
+			overrides.push_back({ option.substr(0, eq), option.substr(eq + 1) });
 		}
-	}
-	for (int i = ArenaResult::Player1Forfeit; i <= ArenaResult::Player8Forfeit; i++) {
-		if (res & i) {
-			msg += "Player" + to_string(i) + "Forfeit\n";
-		}
-	} uint64_t a = 3;
-	for (int i = ArenaResult::Player1Win; i <= ArenaResult::Player8Win; i++) {
-		if (res & i) {
-			msg += "Player" + to_string(i) + "Win\n";
+		else if (arg == "--check")
+			check_only = true;
+		else if (arg == "-h" || arg == "--help") {
+			usage();
+			return 0;
 		}
+		else
+			sc2_argv.push_back(argv[i]);
 	}
-}
 
-static vector<string> make_args(const Bot &bot, int game_port, int start_port, bool is_computer) {
-	vector<string> res;
-	res.push_back(" --GamePort " + std::to_string(game_port));
-	res.push_back(" --StartPort " + std::to_string(start_port));
-	res.push_back(" --LadderServer 127.0.0.1");
-
-	if (is_computer) {
-		res.push_back(" --ComputerOpponent 1");
-		res.push_back(" --ComputerRace " + race_string(bot.race));
-		res.push_back(" --ComputerDifficulty " + difficulty_string(bot.difficulty));
+	ArenaConfig config;
+	vector<string> errors;
+	load_config(config_path, config, errors);
+	for (auto const& o : overrides) {
+		string error;
+		if (!set_option(config, o.first, o.second, error))
+			errors.push_back("--set " + o.first + ": " + error);
+	}
+	// The log's level and format apply from the start; the file only
+	// once the config has checked out
+	LogLevel level = LogInfo;
+	LogFormat format = LogJson;
+	if (ArenaLog::parse_level(config.settings.log_level, level) && ArenaLog::parse_format(config.settings.log_format, format)) {
+		ArenaLog::set_level(level);
+		ArenaLog::instance().open("", format);
+	}
+	if (errors.empty()) {
+		Arena::configure(config, int(sc2_argv.size()), sc2_argv.data());
+		errors = validate_config(config);
+	}
+	// Nothing has started yet, so a bad config costs nothing
+	if (!errors.empty()) {
+		for (auto const& e : errors)
+			cerr << e << endl;
+		return 1;
+	}
+	if (check_only) {
+		cout << config_path << ": " << config.bots.size() << " bots, " << config.maps.size() << " maps, OK" << endl;
+		return 0;
 	}
 
-	return res;
-}
-
-int main(int argc, char* argv[]) {
-	vector<Bot> bots;
-	vector<string> maps;
-
-	Bot b1, b2;
-	b1.name = "5minBot";
-	//b1.path = "C:/dev/CryptBot/x64/Release/CryptBot.exe";
-	b1.path = "C:/dev/5minBot/bin/5minBot.exe";
-	b1.cmd_args = make_args(b1, PORT_P1, PORT_GAME_START, false);
-	b1.race = sc2::Terran;
-	b1.type = sc2::PlayerType::Participant;
-	b1.difficulty = sc2::Difficulty::Easy;
-
-	b2.name = "CryptBot";
-	b2.path = "C:/dev/CryptBot/x64/Release/CryptBot.exe";
-	b2.cmd_args = make_args(b2, PORT_P1 + 1, PORT_GAME_START, false);
-	b2.race = sc2::Protoss;
-	b2.type = sc2::PlayerType::Participant;
-	b2.difficulty = sc2::Difficulty::Easy;
+	if (!settings.log_file.empty() && !ArenaLog::instance().open(settings.log_file, format)) {
+		cerr << "Could not open log file " << settings.log_file << endl;
+		return 1;
+	}
+	Arena::init();
 
-	bots.push_back(b1);
-	bots.push_back(b2);
+	unique_ptr<ResultsStore> results;
+	if (!config.results_path.empty())
+		results.reset(new ResultsStore(config.results_path));
+	unique_ptr<ReplayArchive> replays;
+	if (!config.replay_dir.empty())
+		replays.reset(new ReplayArchive(config.replay_dir));
+	Arena::archive = replays.get();
+	MetricsServer metrics;
+	if (settings.metrics_port > 0)
+		metrics.listen(settings.metrics_port, Arena::write_metrics);
+	Scheduler scheduler(size_t(config.concurrency), 2);
+	scheduler.record_to(results.get());
+	Tournament tournament(config.tournament, config.bots, config.maps, config.checkpoint_path);
+	tournament.run(scheduler);
+	metrics.stop();
+	Arena::shutdown();
+	// The standings below go straight to stdout, after the log
+	ArenaLog::instance().flush();
+	if (results)
+		results->flush();
+	if (replays)
+		replays->flush();
+	Arena::archive = nullptr;
 
-	maps = { "AcolyteLE.SC2Map" };
-	
-	Arena::init(bots, maps);
-	vector<int> results;
-	TournamentType type;
+	vector<double> standings = tournament.standings();
+	for (size_t i = 0; i < config.bots.size(); i++)
+		cout << config.bots[i].name << ": " << standings[i] << " wins" << endl;
 
-	results.push_back(Arena::play(maps[0], argc, argv));
+	if (results) {
+		cout << "Leaderboard" << endl;
+		for (auto const& r : results->leaderboard(20))
+			cout << r.name << " elo " << r.elo << " glicko " << r.glicko << " (rd " << r.glicko_rd << ") "
+				<< r.wins << "-" << r.losses << "-" << r.draws << endl;
+	}
 
 	return 0;
 }
@@ -0,0 +1,128 @@
+#include <map_catalog.h>
+#include <arena_log.h>
+#include <arena.h>
+#include <arena_process.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+// FNV-1a of path in hex, the same from one run to the next
+static string path_hash(const string& path) {
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : path) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+	return hex;
+}
+
+MapCatalog::MapCatalog(const string& process_path, MapDelivery delivery, const string& stage_dir)
+	: process_path(process_path), delivery(delivery), stage_dir(stage_dir) {
+}
+
+bool MapCatalog::parse_delivery(const string& value, MapDelivery& delivery) {
+	if (value == "path")
+		delivery = MapDelivery::MapByPath;
+	else if (value == "inline")
+		delivery = MapDelivery::MapInline;
+	else if (value == "stage")
+		delivery = MapDelivery::MapStaged;
+	else
+		return false;
+
+	return true;
+}
+
+void MapCatalog::add(const vector<string>& names) {
+	for (auto const& name : names) {
+		if (maps.count(name) != 0)
+			continue;
+
+		auto start = chrono::steady_clock::now();
+		CatalogMap m = load(name);
+		auto took = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+		if (m.battlenet)
+			LOG_INFO(nullptr, "Map " << name << " is a Battle.net map");
+		else if (m.found)
+			LOG_INFO(nullptr, "Map " << name << " at " << m.path << (m.data.empty() ? "" : ", " + to_string(m.data.size() / 1024) + "KB inline")
+				<< ", took " << took << "ms");
+		else
+			LOG_WARN(nullptr, "Map " << name << " was not found, sc2 will look for it among remotely saved maps");
+		maps[name] = m;
+	}
+}
+
+const CatalogMap* MapCatalog::find(const string& name) const {
+	auto it = maps.find(name);
+	return it == maps.end() ? nullptr : &it->second;
+}
+
+bool MapCatalog::fill(SC2APIProtocol::RequestCreateGame* request, const string& name) const {
+	const CatalogMap* m = find(name);
+	CatalogMap loaded;
+	if (m == nullptr) {
+		loaded = load(name);
+		m = &loaded;
+	}
+
+	if (m->battlenet) {
+		request->set_battlenet_map_name(m->name);
+		return true;
+	}
+	SC2APIProtocol::LocalMap* local_map = request->mutable_local_map();
+	local_map->set_map_path(m->path);
+	if (!m->data.empty())
+		local_map->set_map_data(m->data);
+
+	return m->found;
+}
+
+CatalogMap MapCatalog::load(const string& name) const {
+	CatalogMap m;
+	m.name = name;
+	SC2APIProtocol::RequestCreateGame request;
+	m.found = Arena::resolve_map(&request, name, process_path);
+	m.battlenet = request.has_battlenet_map_name();
+	if (m.battlenet)
+		return m;
+	m.path = request.local_map().map_path();
+	if (!m.found || delivery == MapDelivery::MapByPath)
+		return m;
+
+	string file = Arena::map_file(name, process_path);
+	ifstream in(file, ios::binary);
+	stringstream bytes;
+	bytes << in.rdbuf();
+	if (!in) {
+		LOG_WARN(nullptr, "Could not read map " << file << ", sending its path instead");
+		return m;
+	}
+
+	if (delivery == MapDelivery::MapInline) {
+		m.data = bytes.str();
+		return m;
+	}
+
+	// Staged under its own name, so sc2's replays still name the map, in
+	// a directory named for where it came from, so maps that share a file
+	// name do not overwrite each other
+	size_t slash = file.find_last_of("/\\");
+	string dir = stage_dir + "/" + path_hash(file);
+	string staged = dir + "/" + (slash == string::npos ? file : file.substr(slash + 1));
+	bool staged_ok = make_dir(stage_dir) && make_dir(dir);
+	if (staged_ok) {
+		ofstream out(staged, ios::binary | ios::trunc);
+		staged_ok = out << bytes.rdbuf() && out.flush();
+	}
+	if (!staged_ok) {
+		LOG_WARN(nullptr, "Could not stage map " << file << " in " << stage_dir << ", sending its path instead");
+		return m;
+	}
+	m.path = staged;
+
+	return m;
+}
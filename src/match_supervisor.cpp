@@ -0,0 +1,40 @@
+#include <match_supervisor.h>
+#include <process_watch.h>
+
+using namespace std;
+
+MatchSupervisor::~MatchSupervisor() {
+	// Unwatching blocks until no exit callback is running, after which
+	// nothing refers to this supervisor
+	for (int id : watches)
+		ProcessWatch::instance().unwatch(id);
+}
+
+void MatchSupervisor::relay_done(size_t player, ClientStatus status) {
+	post({ MatchEvent::RelayDone, player, status });
+}
+
+void MatchSupervisor::watch_bot(size_t player, uint64_t pid, int pidfd) {
+	int id = ProcessWatch::instance().watch(pid, [this, player]() {
+		post({ MatchEvent::BotExit, player, ClientStatus::Running });
+	}, pidfd);
+	watches.push_back(id);
+}
+
+MatchEvent MatchSupervisor::next(chrono::steady_clock::time_point deadline) {
+	unique_lock<mutex> guard(lock);
+	if (!posted.wait_until(guard, deadline, [this] { return !events.empty(); }))
+		return { MatchEvent::Deadline, 0, ClientStatus::Running };
+
+	MatchEvent event = events.front();
+	events.pop_front();
+	return event;
+}
+
+void MatchSupervisor::post(const MatchEvent& event) {
+	// Notified under the lock: once the match has its last event it may
+	// destroy the supervisor, which must not happen mid-notify
+	lock_guard<mutex> guard(lock);
+	events.push_back(event);
+	posted.notify_one();
+}
@@ -0,0 +1,58 @@
+#include <metrics_server.h>
+#include <arena_log.h>
+#include <civetweb.h>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// One scraper at a time is plenty
+#define METRICS_THREADS "1"
+
+MetricsServer::~MetricsServer() {
+	stop();
+}
+
+bool MetricsServer::listen(int port, function<void(ostream&)> render) {
+	this->render = render;
+	string ports = "127.0.0.1:" + to_string(port);
+	const char* options[] = {
+		"listening_ports", ports.c_str(),
+		"num_threads", METRICS_THREADS,
+		nullptr
+	};
+
+	mg_callbacks callbacks;
+	memset(&callbacks, 0, sizeof(callbacks));
+	context = mg_start(&callbacks, this, options);
+	if (context == nullptr) {
+		LOG_WARN(nullptr, "Could not serve metrics on port " << port);
+		return false;
+	}
+
+	mg_set_request_handler(context, "/metrics", &on_request, this);
+	LOG_INFO(nullptr, "Metrics on http://" << ports << "/metrics");
+	return true;
+}
+
+void MetricsServer::stop() {
+	if (context != nullptr) {
+		mg_stop(context);
+		context = nullptr;
+	}
+}
+
+int MetricsServer::on_request(mg_connection* conn, void* user) {
+	MetricsServer* s = static_cast<MetricsServer*>(user);
+	ostringstream body;
+	s->render(body);
+	string text = body.str();
+	mg_printf(conn, "HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n\r\n", text.size());
+	mg_write(conn, text.data(), text.size());
+	// Handled, civetweb sends nothing more
+	return 200;
+}
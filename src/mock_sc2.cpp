@@ -0,0 +1,201 @@
+// Stand-in for the sc2 binary. It speaks enough of the s2client-proto
+// websocket API for the arena and simple bots: ping, create/join game,
+// step, observation, game info, leave and quit. Every other request gets
+// an empty response of the right kind. Launch the arena with
+// "-e path/to/mock_sc2" to play matches without sc2, for example to load
+// test the scheduler with hundreds of games at once.
+//
+// Options, given after the usual sc2 ones:
+//   -gameLoops N   game loop the game ends on, default 22400 (~16 min)
+//   -winner N      player id that wins, 0 for a tie, default 1
+//   -players N     players in a game, default 2
+//   -stepDelay N   us each step takes, default 0
+//   -startDelay N  ms before the port opens, default 0
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <s2clientprotocol/sc2api.pb.h>
+#include <arena_types.h>
+#include <bot_server.h>
+
+using namespace std;
+
+struct MockSettings {
+	string host = BOT_HOST;
+	int port = 0;
+	uint32_t game_loops = 22400;
+	uint32_t winner = 1;
+	uint32_t players = 2;
+	int step_delay_us = 0;
+	int start_delay_ms = 0;
+};
+
+// One sc2 instance's game. An instance that was sent create_game hosts
+// and plays as player 1. Each joining instance knows nothing of the
+// others, so all of them play as player 2, which is enough for 1v1.
+class MockGame {
+public:
+	explicit MockGame(const MockSettings& settings) : settings(settings) {}
+
+	// False once the instance should exit
+	bool handle(const SC2APIProtocol::Request& request, SC2APIProtocol::Response& response) {
+		response.set_id(request.id());
+		switch (request.request_case()) {
+		case SC2APIProtocol::Request::kPing:
+			response.mutable_ping()->set_game_version("mock");
+			response.mutable_ping()->set_data_version("mock");
+			break;
+		case SC2APIProtocol::Request::kCreateGame:
+			response.mutable_create_game();
+			hosting = true;
+			status = SC2APIProtocol::init_game;
+			break;
+		case SC2APIProtocol::Request::kJoinGame:
+			player_id = hosting ? 1 : 2;
+			game_loop = 0;
+			status = SC2APIProtocol::in_game;
+			response.mutable_join_game()->set_player_id(player_id);
+			break;
+		case SC2APIProtocol::Request::kStep:
+			step(max<uint32_t>(request.step().count(), 1));
+			response.mutable_step()->set_simulation_loop(game_loop);
+			break;
+		case SC2APIProtocol::Request::kObservation:
+			observe(*response.mutable_observation());
+			break;
+		case SC2APIProtocol::Request::kGameInfo:
+			game_info(*response.mutable_game_info());
+			break;
+		case SC2APIProtocol::Request::kLeaveGame:
+			response.mutable_leave_game();
+			hosting = false;
+			status = SC2APIProtocol::launched;
+			break;
+		case SC2APIProtocol::Request::kQuit:
+			response.mutable_quit();
+			status = SC2APIProtocol::quit;
+			break;
+		default:
+			empty_response(request, response);
+			break;
+		}
+
+		response.set_status(status);
+		return status != SC2APIProtocol::quit;
+	}
+
+private:
+	void step(uint32_t count) {
+		if (status != SC2APIProtocol::in_game)
+			return;
+
+		if (settings.step_delay_us > 0)
+			this_thread::sleep_for(chrono::microseconds(settings.step_delay_us));
+		game_loop = min(game_loop + count, settings.game_loops);
+		if (game_loop >= settings.game_loops)
+			status = SC2APIProtocol::ended;
+	}
+
+	void observe(SC2APIProtocol::ResponseObservation& observation) {
+		observation.mutable_observation()->set_game_loop(game_loop);
+		if (status != SC2APIProtocol::ended)
+			return;
+
+		for (uint32_t id = 1; id <= settings.players; id++) {
+			auto result = observation.add_player_result();
+			result->set_player_id(id);
+			if (settings.winner == 0)
+				result->set_result(SC2APIProtocol::Tie);
+			else
+				result->set_result(id == settings.winner ? SC2APIProtocol::Victory : SC2APIProtocol::Defeat);
+		}
+	}
+
+	void game_info(SC2APIProtocol::ResponseGameInfo& info) {
+		info.set_map_name("Mock");
+		for (uint32_t id = 1; id <= settings.players; id++) {
+			auto player = info.add_player_info();
+			player->set_player_id(id);
+			player->set_type(SC2APIProtocol::Participant);
+		}
+	}
+
+	// Request and Response number their oneof cases alike
+	static void empty_response(const SC2APIProtocol::Request& request, SC2APIProtocol::Response& response) {
+		auto field = SC2APIProtocol::Response::descriptor()->FindFieldByNumber(int(request.request_case()));
+		if (field != nullptr && field->message_type() != nullptr)
+			response.GetReflection()->MutableMessage(&response, field);
+	}
+
+	const MockSettings& settings;
+	SC2APIProtocol::Status status = SC2APIProtocol::launched;
+	bool hosting = false;
+	uint32_t player_id = 0;
+	uint32_t game_loop = 0;
+};
+
+static MockSettings parse_settings(int argc, char* argv[]) {
+	MockSettings s;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		string flag = argv[i];
+		string value = argv[i + 1];
+		if (flag == "-listen")
+			s.host = value;
+		else if (flag == "-port")
+			s.port = atoi(value.c_str());
+		else if (flag == "-gameLoops")
+			s.game_loops = uint32_t(max(atoi(value.c_str()), 1));
+		else if (flag == "-winner")
+			s.winner = uint32_t(max(atoi(value.c_str()), 0));
+		else if (flag == "-players")
+			s.players = uint32_t(min(max(atoi(value.c_str()), 1), MAX_PLAYERS));
+		else if (flag == "-stepDelay")
+			s.step_delay_us = max(atoi(value.c_str()), 0);
+		else if (flag == "-startDelay")
+			s.start_delay_ms = max(atoi(value.c_str()), 0);
+		// Anything else is an sc2 option the mock has no use for
+	}
+
+	return s;
+}
+
+int main(int argc, char* argv[]) {
+	MockSettings settings = parse_settings(argc, argv);
+	if (settings.port == 0) {
+		cerr << "usage: mock_sc2 -listen <host> -port <port> [options]" << endl;
+		return 1;
+	}
+
+	this_thread::sleep_for(chrono::milliseconds(settings.start_delay_ms));
+
+	// The arena connects to sc2 exactly like a bot connects to the arena
+	BotServer server;
+	if (!server.listen(settings.port, REQUEST_TIMEOUT, "2"))
+		return 1;
+
+	MockGame game(settings);
+	string message;
+	SC2APIProtocol::Request request;
+	SC2APIProtocol::Response response;
+	while (true) {
+		if (!server.wait_request(message, chrono::milliseconds(1000))) {
+			// Nobody connected, or the connection went away
+			if (!server.connected())
+				this_thread::sleep_for(chrono::milliseconds(10));
+			continue;
+		}
+		if (!request.ParseFromString(message))
+			continue;
+
+		response.Clear();
+		bool running = game.handle(request, response);
+		server.send(response);
+		if (!running)
+			break;
+	}
+
+	server.stop();
+	return 0;
+}
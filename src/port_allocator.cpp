@@ -0,0 +1,111 @@
+#include <port_allocator.h>
+#include <arena_types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+PortAllocator::PortAllocator(int first, int last) : first(first), last(last), cursor(first) {
+#ifdef _WIN32
+	WSADATA data;
+	WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+int PortAllocator::lease(size_t count) {
+	int n = int(count);
+	if (n <= 0 || n > last - first + 1)
+		return 0;
+
+	lock_guard<mutex> guard(lock);
+	// One lap of the range, beginning at the cursor and wrapping
+	int range = last - first + 1;
+	int start = cursor;
+	for (int tried = 0; tried < range; ) {
+		if (start + n - 1 > last) {
+			tried += last + 1 - start;
+			start = first;
+			continue;
+		}
+
+		// Skip past the lease this block would overlap, if any
+		auto next = leases.lower_bound(start + n);
+		if (next != leases.begin()) {
+			auto before = prev(next);
+			int end = before->first + before->second;
+			if (end > start) {
+				tried += end - start;
+				start = end;
+				continue;
+			}
+		}
+
+		int bad = 0;
+		for (int port = start; port < start + n && bad == 0; port++)
+			if (!probe(port))
+				bad = port;
+		if (bad == 0) {
+			leases[start] = n;
+			cursor = start + n;
+			return start;
+		}
+
+		// Nothing starting at or before the busy port can fit
+		tried += bad + 1 - start;
+		start = bad + 1;
+	}
+
+	return 0;
+}
+
+void PortAllocator::release(int start) {
+	lock_guard<mutex> guard(lock);
+	leases.erase(start);
+}
+
+size_t PortAllocator::leased_ports() {
+	lock_guard<mutex> guard(lock);
+	size_t res = 0;
+	for (auto const& l : leases)
+		res += l.second;
+
+	return res;
+}
+
+// Binds the way a listener on BOT_HOST would. Reusing addresses lets
+// ports with connections in TIME_WAIT count as free, as they do for
+// civetweb and sc2.
+bool PortAllocator::probe(int port) {
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(uint16_t(port));
+	inet_pton(AF_INET, BOT_HOST, &addr.sin_addr);
+
+#ifdef _WIN32
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET)
+		return false;
+	BOOL exclusive = TRUE;
+	setsockopt(s, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof(exclusive));
+	bool res = ::bind(s, (sockaddr*)&addr, sizeof(addr)) == 0;
+	closesocket(s);
+#else
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0)
+		return false;
+	int reuse = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	bool res = ::bind(s, (sockaddr*)&addr, sizeof(addr)) == 0;
+	close(s);
+#endif
+
+	return res;
+}
@@ -0,0 +1,196 @@
+#include <process_watch.h>
+#include <arena_process.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+#define PROCESS_WATCH_FALLBACK_MS 100
+
+ProcessWatch& ProcessWatch::instance() {
+	static ProcessWatch watch;
+	return watch;
+}
+
+#ifdef _WIN32
+static void CALLBACK on_process_exit(PVOID context, BOOLEAN timed_out) {
+	auto on_exit = static_cast<function<void()>*>(context);
+	(*on_exit)();
+}
+
+ProcessWatch::ProcessWatch() {
+}
+
+ProcessWatch::~ProcessWatch() {
+	lock_guard<mutex> guard(lock);
+	for (auto& w : watches) {
+		UnregisterWaitEx(w.second->wait, INVALID_HANDLE_VALUE);
+		CloseHandle(w.second->process);
+		delete w.second;
+	}
+}
+
+int ProcessWatch::watch(uint64_t pid, function<void()> on_exit, int pidfd) {
+	Watch* w = new Watch();
+	w->pid = pid;
+	w->on_exit = on_exit;
+	w->process = OpenProcess(SYNCHRONIZE, false, (DWORD)pid);
+	if (w->process == NULL) {
+		// Already gone
+		delete w;
+		on_exit();
+		return 0;
+	}
+
+	HANDLE wait;
+	RegisterWaitForSingleObject(&wait, w->process, &on_process_exit, &w->on_exit, INFINITE, WT_EXECUTEONLYONCE);
+	w->wait = wait;
+
+	lock_guard<mutex> guard(lock);
+	watches[next_id] = w;
+	return next_id++;
+}
+
+void ProcessWatch::unwatch(int id) {
+	Watch* w;
+	{
+		lock_guard<mutex> guard(lock);
+		auto it = watches.find(id);
+		if (it == watches.end())
+			return;
+		w = it->second;
+		watches.erase(it);
+	}
+
+	// Waits for a callback that is already running
+	UnregisterWaitEx(w->wait, INVALID_HANDLE_VALUE);
+	CloseHandle(w->process);
+	delete w;
+}
+#else
+ProcessWatch::ProcessWatch() {
+	if (pipe(wake_pipe) == 0) {
+		fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+	}
+	watcher = thread(&ProcessWatch::run, this);
+}
+
+ProcessWatch::~ProcessWatch() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake();
+	watcher.join();
+
+	for (auto& w : watches) {
+		if (w.second->handle >= 0)
+			close(w.second->handle);
+		delete w.second;
+	}
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+}
+
+void ProcessWatch::wake() {
+	char c = 0;
+	if (write(wake_pipe[1], &c, 1) < 0) {
+		// Full, the watcher is waking anyway
+	}
+}
+
+int ProcessWatch::watch(uint64_t pid, function<void()> on_exit, int pidfd) {
+	Watch* w = new Watch();
+	w->pid = pid;
+	w->on_exit = on_exit;
+	w->handle = pidfd;
+#ifdef SYS_pidfd_open
+	if (w->handle < 0)
+		w->handle = int(syscall(SYS_pidfd_open, pid_t(pid), 0));
+#endif
+
+	int id;
+	{
+		lock_guard<mutex> guard(lock);
+		id = next_id++;
+		watches[id] = w;
+	}
+	wake();
+
+	return id;
+}
+
+void ProcessWatch::unwatch(int id) {
+	// The watcher calls back under the lock, so once we hold it no
+	// callback is running
+	lock_guard<mutex> guard(lock);
+	auto it = watches.find(id);
+	if (it == watches.end())
+		return;
+
+	if (it->second->handle >= 0)
+		close(it->second->handle);
+	delete it->second;
+	watches.erase(it);
+	wake();
+}
+
+void ProcessWatch::run() {
+	vector<pollfd> fds;
+	vector<int> ids;
+	while (true) {
+		bool fallback = false;
+		fds.assign(1, { wake_pipe[0], POLLIN, 0 });
+		ids.assign(1, 0);
+		{
+			lock_guard<mutex> guard(lock);
+			if (stopping)
+				return;
+			for (auto& w : watches) {
+				if (w.second->fired)
+					continue;
+				if (w.second->handle < 0) {
+					fallback = true;
+					continue;
+				}
+				fds.push_back({ w.second->handle, POLLIN, 0 });
+				ids.push_back(w.first);
+			}
+		}
+
+		poll(fds.data(), fds.size(), fallback ? PROCESS_WATCH_FALLBACK_MS : -1);
+		char drain[64];
+		while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+		}
+
+		lock_guard<mutex> guard(lock);
+		if (stopping)
+			return;
+		// A pidfd turns readable when its process exits. Watches added or
+		// dropped since the poll started are picked up next time round.
+		for (size_t i = 1; i < fds.size(); i++) {
+			auto it = watches.find(ids[i]);
+			if (it == watches.end() || it->second->fired || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			it->second->fired = true;
+			it->second->on_exit();
+		}
+		if (fallback) {
+			for (auto& w : watches) {
+				if (w.second->fired || w.second->handle >= 0 || !proc_exited(w.second->pid))
+					continue;
+				w.second->fired = true;
+				w.second->on_exit();
+			}
+		}
+	}
+}
+#endif
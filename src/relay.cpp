@@ -0,0 +1,262 @@
+#include <relay.h>
+#include <arena_log.h>
+#include <relay_trace.h>
+#include <step_barrier.h>
+#include <algorithm>
+
+using namespace std;
+
+static string request_name(SC2APIProtocol::Request::RequestCase type) {
+	auto field = SC2APIProtocol::Request::descriptor()->FindFieldByNumber(int(type));
+	return field != nullptr ? field->name() : to_string(int(type));
+}
+
+shared_ptr<Relay> Relay::start(RelayExecutor& executor, GameConnection* client, BotServer* server,
+	RelayState* state, function<void(ClientStatus)> done) {
+	shared_ptr<Relay> relay(new Relay(executor, client, server, state, done));
+
+	// The queues only hold on weakly, a finished relay is freed even if
+	// its connections outlive it
+	weak_ptr<Relay> weak = relay;
+	auto wake = [weak]() {
+		if (auto r = weak.lock())
+			r->wake();
+	};
+	server->on_request(wake);
+	client->on_response(wake);
+
+	// The bot may have sent something already
+	relay->wake();
+	return relay;
+}
+
+Relay::Relay(RelayExecutor& executor, GameConnection* client, BotServer* server,
+	RelayState* state, function<void(ClientStatus)> done)
+	: executor(executor), client(client), server(server), state(state), done(done) {
+	auto now = chrono::steady_clock::now();
+	responded = now;
+	deadline = now + state->bot_timeout;
+}
+
+void Relay::cancel() {
+	cancelled = true;
+	wake();
+}
+
+// Queues a run unless one is already queued or running. A run keeps
+// going until it has handled every wakeup that came in meanwhile.
+void Relay::wake() {
+	if (wakeups.fetch_add(1) == 0) {
+		auto self = shared_from_this();
+		executor.submit([self]() { self->run(); });
+	}
+}
+
+void Relay::run() {
+	uint32_t seen = wakeups.load();
+	while (true) {
+		advance();
+		uint32_t left = wakeups.fetch_sub(seen) - seen;
+		if (left == 0)
+			break;
+		seen = left;
+	}
+}
+
+void Relay::advance() {
+	// Messages stay as the bytes read off each socket and are only peeked
+	// at, never parsed into a Request/Response and serialized again.
+	while (!finished) {
+		if (cancelled) {
+			finish(ClientStatus::Running);
+			return;
+		}
+
+		auto now = chrono::steady_clock::now();
+		if (!awaiting_response) {
+			if (server->try_request(message, arrived)) {
+				handle_request(now);
+				continue;
+			}
+			if (server->drained()) {
+				LOG_WARN(&state->log, "Client disconnect");
+				finish(ClientStatus::ClientTimeout);
+				return;
+			}
+			if (now >= deadline) {
+				if (limited) {
+					LOG_WARN(&state->log, "Client out of time");
+					state->time_bank = chrono::milliseconds(0);
+					finish(ClientStatus::OutOfTime);
+				}
+				else {
+					LOG_WARN(&state->log, "Client timeout");
+					finish(ClientStatus::ClientTimeout);
+				}
+				return;
+			}
+		}
+		else {
+			if (client->try_response(message)) {
+				handle_response(now);
+				continue;
+			}
+			if (!client->connected()) {
+				LOG_WARN(&state->log, "Game disconnect");
+				finish(ClientStatus::ClientTimeout);
+				return;
+			}
+			if (now >= deadline) {
+				// The late response would be taken for the answer to the
+				// bot's next request, so there is no carrying on
+				LOG_WARN(&state->log, "No response from sc2 in time");
+				finish(ClientStatus::GameError);
+				return;
+			}
+		}
+
+		arm(deadline);
+		return;
+	}
+}
+
+void Relay::handle_request(chrono::steady_clock::time_point now) {
+	// Timed to when the request arrived, time it spent waiting for the
+	// executor is not the bot's
+	if (answered) {
+		auto think = max(arrived - responded, chrono::steady_clock::duration(0));
+		state->metrics.bot_time(think);
+		if (budgeted && state->step_limit.count() > 0 && think > state->step_limit) {
+			state->overruns++;
+			state->time_bank -= chrono::duration_cast<chrono::milliseconds>(think - state->step_limit);
+			if (state->time_bank.count() < 0) {
+				LOG_WARN(&state->log, "Client out of time");
+				state->time_bank = chrono::milliseconds(0);
+				finish(ClientStatus::OutOfTime);
+				return;
+			}
+		}
+	}
+
+	pending = peek_request(message);
+	// Per message detail, only formatted at the debug level
+	LOG_DEBUG(&state->log, request_name(pending) << " request, " << message.size() << " bytes");
+	if (state->realtime && pending == SC2APIProtocol::Request::kAction)
+		state->pacing.acted(arrived);
+	if (pending == SC2APIProtocol::Request::kQuit || pending == SC2APIProtocol::Request::kLeaveGame) {
+		// Intercept leave game and quit requests, we want to keep game alive to save replays
+		finish(ClientStatus::Quit);
+		return;
+	}
+
+	if (state->trace != nullptr)
+		state->trace->record(TraceRequest, message);
+	sent = now;
+	awaiting_response = true;
+	if (pending == SC2APIProtocol::Request::kStep && state->lockstep != nullptr
+		&& state->lockstep->arrive(state->seat, message)) {
+		// Held until the slowest player has stepped too, who has the bot
+		// timeout to do so
+		deadline = now + state->bot_timeout + state->game_timeout;
+		return;
+	}
+	client->send(message);
+
+	// join_game is only answered once every player has joined
+	deadline = now + (pending == SC2APIProtocol::Request::kJoinGame ? state->join_timeout : state->game_timeout);
+}
+
+void Relay::handle_response(chrono::steady_clock::time_point now) {
+	if (pending == SC2APIProtocol::Request::kStep && state->lockstep != nullptr)
+		sent = state->lockstep->dispatched(state->seat);
+	state->metrics.sc2_time(pending, now - sent);
+	if (pending == SC2APIProtocol::Request::kJoinGame)
+		state->join_time = now - sent;
+	if (state->trace != nullptr)
+		state->trace->record(TraceResponse, message);
+
+	if (peek_response(message, peek)) {
+		if (peek.status > SC2APIProtocol::Status::in_replay) {
+			status = ClientStatus::GameEnd;
+		}
+		if (peek.has_game_loop) {
+			state->game_loop.store(peek.game_loop, memory_order_relaxed);
+			if (state->realtime && pending == SC2APIProtocol::Request::kObservation)
+				state->pacing.observed(peek.game_loop, now);
+			if (peek.game_loop > state->max_game_loops)
+				status = ClientStatus::GameTimeout;
+		}
+		// Results ride along on the observation the bot asks for
+		// anyway, so the arena never has to query the game itself.
+		if (peek.player_id != 0) {
+			state->player_id = peek.player_id;
+			budgeted = true;
+		}
+		if (peek.has_results) {
+			state->has_results = true;
+			copy(begin(peek.results), end(peek.results), state->results);
+		}
+	}
+
+	LOG_DEBUG(&state->log, request_name(pending) << " response, " << message.size() << " bytes in "
+		<< chrono::duration_cast<chrono::microseconds>(now - sent).count() << "us, game loop "
+		<< state->game_loop.load(memory_order_relaxed));
+	if (pending == SC2APIProtocol::Request::kStep)
+		state->metrics.step(state->game_loop.load(memory_order_relaxed));
+
+	// Send the response back to the client.
+	server->send(message);
+	answered = true;
+	if (status != ClientStatus::Running) {
+		finish(status);
+		return;
+	}
+	await_request(chrono::steady_clock::now());
+}
+
+void Relay::await_request(chrono::steady_clock::time_point now) {
+	awaiting_response = false;
+	responded = now;
+
+	// Past the step limit plus whatever is left in the bank the bot has
+	// lost, so there is no point waiting the full bot timeout for it.
+	chrono::milliseconds wait = state->bot_timeout;
+	limited = budgeted && state->step_limit.count() > 0 && state->step_limit + state->time_bank < wait;
+	if (limited)
+		wait = state->step_limit + state->time_bank;
+	deadline = now + wait;
+}
+
+// Keeps one timer in flight. Deadlines mostly move later, in which case
+// the timer that fires early just re-arms for the new one.
+void Relay::arm(chrono::steady_clock::time_point when) {
+	{
+		lock_guard<mutex> guard(timer_lock);
+		if (timer_armed && timer_at <= when)
+			return;
+		timer_armed = true;
+		timer_at = when;
+	}
+
+	weak_ptr<Relay> weak = shared_from_this();
+	executor.submit_at(when, [weak, when]() {
+		auto r = weak.lock();
+		if (!r)
+			return;
+		{
+			lock_guard<mutex> guard(r->timer_lock);
+			if (r->timer_at == when)
+				r->timer_armed = false;
+		}
+		r->wake();
+	});
+}
+
+void Relay::finish(ClientStatus result) {
+	finished = true;
+	client->on_response(nullptr);
+	if (state->lockstep != nullptr)
+		state->lockstep->leave(state->seat);
+	// Last thing touching the match, which may be torn down right after
+	done(result);
+}
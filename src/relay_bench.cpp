@@ -0,0 +1,148 @@
+// Replays a recorded trace through a Relay as fast as it will go, with
+// the bot and sc2 sides played back from the trace over local websockets.
+// Needs no sc2 install, so relay changes can be compared on any machine.
+//
+//   relay_bench <trace> [repeat] [relay threads]
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <arena_types.h>
+#include <bot_server.h>
+#include <game_connection.h>
+#include <message_queue.h>
+#include <relay.h>
+#include <relay_executor.h>
+#include <relay_trace.h>
+#include <wire_peek.h>
+
+using namespace std;
+
+#define BENCH_SC2_PORT 5900
+#define BENCH_BOT_PORT 5901
+
+// Counts every operator new in the process, for allocations per step
+static atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, memory_order_relaxed);
+	if (void* p = malloc(size == 0 ? 1 : size))
+		return p;
+	throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+struct Exchange {
+	string request;
+	string response;
+};
+
+// Pairs each request with the response that followed it. Stops before
+// the game ends so the relay keeps going however often it is replayed.
+static vector<Exchange> exchanges_of(const vector<TraceRecord>& records) {
+	vector<Exchange> res;
+	ResponsePeek peek;
+	for (size_t i = 0; i + 1 < records.size(); i++) {
+		if (records[i].direction != TraceRequest || records[i + 1].direction != TraceResponse)
+			continue;
+		if (peek_response(records[i + 1].message, peek) && peek.status > SC2APIProtocol::Status::in_replay)
+			break;
+		res.push_back({ records[i].message, records[i + 1].message });
+		i++;
+	}
+
+	return res;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		cerr << "usage: relay_bench <trace> [repeat] [relay threads]" << endl;
+		return 1;
+	}
+	int repeat = argc > 2 ? max(atoi(argv[2]), 1) : 1;
+	size_t threads = argc > 3 ? size_t(atoi(argv[3])) : 0;
+
+	vector<TraceRecord> records;
+	if (!load_trace(argv[1], records)) {
+		cerr << "Could not read trace " << argv[1] << endl;
+		return 1;
+	}
+	vector<Exchange> exchanges = exchanges_of(records);
+	if (exchanges.empty()) {
+		cerr << "No request/response pairs in " << argv[1] << endl;
+		return 1;
+	}
+	size_t total = exchanges.size() * repeat;
+
+	// sc2 stand-in: answers the nth request with the nth recorded response
+	BotServer sc2;
+	if (!sc2.listen(BENCH_SC2_PORT, REQUEST_TIMEOUT, "2"))
+		return 1;
+	thread sc2_side([&]() {
+		string request;
+		for (size_t i = 0; i < total; i++) {
+			if (!sc2.wait_request(request, chrono::milliseconds(GAME_TIMEOUT)))
+				return;
+			sc2.send(exchanges[i % exchanges.size()].response);
+		}
+	});
+
+	RelayExecutor executor(threads);
+	GameConnection upstream;
+	BotServer server;
+	GameConnection bot;
+	if (!upstream.connect(BOT_HOST, BENCH_SC2_PORT) || !server.listen(BENCH_BOT_PORT, REQUEST_TIMEOUT, "2")
+		|| !bot.connect(BOT_HOST, BENCH_BOT_PORT))
+		return 1;
+
+	RelayState state;
+	promise<ClientStatus> finished;
+	auto relay = Relay::start(executor, &upstream, &server, &state,
+		[&finished](ClientStatus status) { finished.set_value(status); });
+
+	// Bot stand-in: sends each recorded request as soon as the last
+	// response is in
+	string response;
+	size_t completed = 0;
+	uint64_t allocations_start = allocations.load();
+	uint64_t buffers_start = message_allocations().load();
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < total; i++) {
+		if (!bot.send(exchanges[i % exchanges.size()].request) || !bot.wait_response(response, chrono::milliseconds(GAME_TIMEOUT)))
+			break;
+		completed++;
+	}
+	auto wall = chrono::steady_clock::now() - start;
+	uint64_t allocated = allocations.load() - allocations_start;
+	uint64_t buffers = message_allocations().load() - buffers_start;
+
+	relay->cancel();
+	finished.get_future().wait();
+	bot.disconnect();
+	upstream.disconnect();
+	server.stop();
+	sc2.stop();
+	sc2_side.join();
+
+	double seconds = chrono::duration<double>(wall).count();
+	uint64_t steps = state.metrics.steps();
+	cout << completed << " of " << total << " exchanges in " << seconds * 1000 << "ms on "
+		<< executor.size() << " relay threads" << endl;
+	cout << "  " << completed / seconds << " exchanges/s, " << steps / seconds << " steps/s, "
+		<< seconds * 1e6 / max<size_t>(completed, 1) << "us per exchange" << endl;
+	cout << "  " << double(allocated) / max<size_t>(completed, 1) << " allocations per exchange, "
+		<< (steps > 0 ? double(allocated) / steps : 0) << " per step, "
+		<< buffers << " by message queues" << endl;
+	state.metrics.print_summary(cout, "trace");
+
+	return completed == total ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include <relay_executor.h>
+#include <algorithm>
+
+using namespace std;
+
+// Which worker of which executor the current thread is, so tasks
+// submitted from a task stay on the worker that is already warm
+static thread_local RelayExecutor* current_executor = nullptr;
+static thread_local size_t current_worker = 0;
+
+RelayExecutor::RelayExecutor(size_t count) {
+	if (count == 0)
+		count = max<unsigned>(thread::hardware_concurrency(), 1);
+
+	for (size_t i = 0; i < count; i++)
+		workers.emplace_back(new Worker());
+	for (size_t i = 0; i < count; i++)
+		threads.emplace_back(&RelayExecutor::work, this, i);
+	timer_thread = thread(&RelayExecutor::run_timers, this);
+}
+
+RelayExecutor::~RelayExecutor() {
+	{
+		lock_guard<mutex> guard(sleep_lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	{
+		lock_guard<mutex> guard(timer_lock);
+	}
+	timer_wake.notify_all();
+
+	for (auto& t : threads)
+		t.join();
+	timer_thread.join();
+}
+
+void RelayExecutor::submit(function<void()> task) {
+	size_t index = current_executor == this
+		? current_worker
+		: next_worker.fetch_add(1, memory_order_relaxed) % workers.size();
+	{
+		lock_guard<mutex> guard(workers[index]->lock);
+		workers[index]->tasks.push_back(move(task));
+	}
+
+	queued.fetch_add(1);
+	// Taking the lock orders this with a worker checking queued on its
+	// way to sleep, so the wakeup cannot fall in between
+	{
+		lock_guard<mutex> guard(sleep_lock);
+	}
+	wake.notify_one();
+}
+
+void RelayExecutor::submit_at(chrono::steady_clock::time_point when, function<void()> task) {
+	bool earliest;
+	{
+		lock_guard<mutex> guard(timer_lock);
+		earliest = timers.empty() || when < timers.top().when;
+		timers.push({ when, move(task) });
+	}
+	if (earliest)
+		timer_wake.notify_one();
+}
+
+// Own queue newest first while its data is still in cache, other
+// queues oldest first so a steal takes work that has waited longest.
+bool RelayExecutor::pop(size_t index, function<void()>& task) {
+	{
+		Worker& own = *workers[index];
+		lock_guard<mutex> guard(own.lock);
+		if (!own.tasks.empty()) {
+			task = move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < workers.size(); i++) {
+		Worker& other = *workers[(index + i) % workers.size()];
+		lock_guard<mutex> guard(other.lock);
+		if (!other.tasks.empty()) {
+			task = move(other.tasks.front());
+			other.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void RelayExecutor::work(size_t index) {
+	current_executor = this;
+	current_worker = index;
+
+	function<void()> task;
+	while (true) {
+		if (pop(index, task)) {
+			queued.fetch_sub(1);
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		unique_lock<mutex> guard(sleep_lock);
+		wake.wait(guard, [this] { return queued.load() > 0 || stopping; });
+		if (stopping)
+			return;
+	}
+}
+
+void RelayExecutor::run_timers() {
+	unique_lock<mutex> guard(timer_lock);
+	while (true) {
+		{
+			lock_guard<mutex> sleep_guard(sleep_lock);
+			if (stopping)
+				return;
+		}
+
+		if (timers.empty()) {
+			timer_wake.wait(guard);
+			continue;
+		}
+
+		auto when = timers.top().when;
+		if (chrono::steady_clock::now() < when) {
+			timer_wake.wait_until(guard, when);
+			continue;
+		}
+
+		function<void()> task = move(const_cast<Timer&>(timers.top()).task);
+		timers.pop();
+		guard.unlock();
+		submit(move(task));
+		guard.lock();
+	}
+}
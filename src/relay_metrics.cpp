@@ -0,0 +1,208 @@
+#include <relay_metrics.h>
+#include <algorithm>
+#include <fstream>
+#include <s2clientprotocol/sc2api.pb.h>
+
+using namespace std;
+
+// Enough for an hour of game at one step per 4 loops before the series
+// has to grow
+#define SERIES_RESERVE 20000
+
+// The writer is the only thread that stores, so a load then a store is a
+// safe increment and avoids a locked add on the relay's hot path.
+static inline void bump(atomic<uint64_t>& counter, uint64_t by) {
+	counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+static inline uint64_t to_us(chrono::nanoseconds latency) {
+	return uint64_t(max<int64_t>(chrono::duration_cast<chrono::microseconds>(latency).count(), 0));
+}
+
+void LatencyHistogram::record(chrono::nanoseconds latency) {
+	uint64_t us = to_us(latency);
+	// On the nanoseconds, so a latency just over 2^b us is not rounded
+	// down into bucket b
+	uint64_t ns = uint64_t(max<int64_t>(latency.count(), 0));
+	size_t bucket = 0;
+	while (bucket < LATENCY_BUCKETS - 1 && (uint64_t(1000) << bucket) < ns)
+		bucket++;
+
+	bump(buckets[bucket], 1);
+	bump(samples, 1);
+	bump(sum_us, us);
+	if (us > peak_us.load(memory_order_relaxed))
+		peak_us.store(us, memory_order_relaxed);
+}
+
+double LatencyHistogram::mean_ms() const {
+	uint64_t n = count();
+	return n > 0 ? total_us() / 1000.0 / n : 0;
+}
+
+double LatencyHistogram::quantile_ms(double q) const {
+	uint64_t n = count();
+	if (n == 0)
+		return 0;
+
+	uint64_t rank = uint64_t(q * (n - 1)) + 1;
+	uint64_t seen = 0;
+	for (size_t b = 0; b < LATENCY_BUCKETS - 1; b++) {
+		seen += buckets[b].load(memory_order_relaxed);
+		if (seen >= rank)
+			return min(uint64_t(1) << b, max_us()) / 1000.0;
+	}
+
+	return max_us() / 1000.0;
+}
+
+// Stamps counter with now, for last_activity
+static inline void touch(atomic<int64_t>& counter) {
+	counter.store(chrono::steady_clock::now().time_since_epoch().count(), memory_order_relaxed);
+}
+
+RelayMetrics::RelayMetrics() {
+	samples.reserve(SERIES_RESERVE);
+	touch(last_ns);
+}
+
+void RelayMetrics::bot_time(chrono::nanoseconds latency) {
+	touch(last_ns);
+	bot_latency.record(latency);
+	pending_bot_us += to_us(latency);
+}
+
+void RelayMetrics::sc2_time(int request_type, chrono::nanoseconds latency) {
+	touch(last_ns);
+	uint64_t us = to_us(latency);
+	sc2_latency.record(latency);
+	if (request_type == SC2APIProtocol::Request::kStep)
+		step_latency.record(latency);
+	pending_sc2_us += us;
+
+	if (request_type < 0 || request_type >= REQUEST_TYPES)
+		request_type = 0;
+	bump(request_count[request_type], 1);
+	bump(request_us[request_type], us);
+}
+
+void RelayMetrics::step(uint32_t game_loop) {
+	bump(step_count, 1);
+	samples.push_back({ game_loop, uint32_t(min<uint64_t>(pending_bot_us, UINT32_MAX)),
+		uint32_t(min<uint64_t>(pending_sc2_us, UINT32_MAX)) });
+	pending_bot_us = 0;
+	pending_sc2_us = 0;
+}
+
+uint64_t RelayMetrics::requests(int request_type) const {
+	if (request_type < 0 || request_type >= REQUEST_TYPES)
+		return 0;
+
+	return request_count[request_type].load(memory_order_relaxed);
+}
+
+static void print_histogram(ostream& out, const char* name, const LatencyHistogram& h) {
+	out << "  " << name << ": " << h.count() << " samples, avg " << h.mean_ms()
+		<< "ms, p50 " << h.quantile_ms(0.5) << "ms, p99 " << h.quantile_ms(0.99)
+		<< "ms, max " << h.max_us() / 1000.0 << "ms" << endl;
+}
+
+void RelayMetrics::print_summary(ostream& out, const string& name) const {
+	out << "bot " << name << ": " << steps() << " steps" << endl;
+	print_histogram(out, "bot think", bot_latency);
+	print_histogram(out, "sc2      ", sc2_latency);
+	print_histogram(out, "sc2 step ", step_latency);
+
+	out << "  requests:";
+	auto descriptor = SC2APIProtocol::Request::descriptor();
+	for (int i = 0; i < REQUEST_TYPES; i++) {
+		uint64_t n = request_count[i].load(memory_order_relaxed);
+		if (n == 0)
+			continue;
+		auto field = descriptor->FindFieldByNumber(i);
+		out << " " << (field != nullptr ? field->name() : to_string(i)) << "=" << n
+			<< " (" << request_us[i].load(memory_order_relaxed) / 1000.0 / n << "ms)";
+	}
+	out << endl;
+}
+
+void RealtimeMetrics::observed(uint32_t game_loop, chrono::steady_clock::time_point at) {
+	if (!started) {
+		started = true;
+		origin = at;
+		origin_loop = game_loop;
+	}
+	else if (game_loop > last_loop) {
+		uint64_t gap = game_loop - last_loop - 1;
+		size_t bucket = 0;
+		while (bucket < LOOP_GAP_BUCKETS - 1 && (uint64_t(1) << bucket) <= gap)
+			bucket++;
+		bump(gaps[bucket], 1);
+		bump(missed, gap);
+		if (gap > peak_gap.load(memory_order_relaxed))
+			peak_gap.store(gap, memory_order_relaxed);
+	}
+	else if (game_loop == last_loop) {
+		// Asked again before sc2 moved on, nothing missed or new
+		return;
+	}
+
+	// Where the game would be if sc2 kept to the wall clock
+	double expected = origin_loop + chrono::duration<double>(at - origin).count() * REALTIME_LOOPS_PER_SECOND;
+	if (expected > game_loop) {
+		uint64_t lag = uint64_t((expected - game_loop) * 1000);
+		if (lag > peak_lag.load(memory_order_relaxed))
+			peak_lag.store(lag, memory_order_relaxed);
+	}
+
+	bump(observation_count, 1);
+	last_loop = game_loop;
+	last_observation = at;
+	answered = false;
+}
+
+void RealtimeMetrics::acted(chrono::steady_clock::time_point at) {
+	if (answered)
+		return;
+
+	latency.record(at - last_observation);
+	answered = true;
+}
+
+void RealtimeMetrics::print_summary(ostream& out) const {
+	uint64_t n = observations();
+	out << "  realtime: " << n << " observations, " << missed_loops() << " loops missed between them ("
+		<< (n > 0 ? double(missed_loops()) / n : 0) << " per observation, at most " << max_gap()
+		<< "), sc2 up to " << max_lag_loops() << " loops behind the clock" << endl;
+	out << "  loops skipped:";
+	for (size_t g = 0; g < LOOP_GAP_BUCKETS; g++) {
+		uint64_t count = gaps[g].load(memory_order_relaxed);
+		if (count == 0)
+			continue;
+		if (g == 0)
+			out << " 0=" << count;
+		else if (g == LOOP_GAP_BUCKETS - 1)
+			out << " " << (uint64_t(1) << (g - 1)) << "+=" << count;
+		else
+			out << " " << (uint64_t(1) << (g - 1)) << "-" << (uint64_t(1) << g) - 1 << "=" << count;
+	}
+	out << endl;
+	// The loops the game moved on while the bot decided
+	const double loop_ms = 1000 / REALTIME_LOOPS_PER_SECOND;
+	print_histogram(out, "action   ", latency);
+	out << "  action latency in loops: p50 " << latency.quantile_ms(0.5) / loop_ms << ", p99 "
+		<< latency.quantile_ms(0.99) / loop_ms << ", max " << latency.max_us() / 1000.0 / loop_ms << endl;
+}
+
+bool write_series(const string& path, const vector<const RelayMetrics*>& players) {
+	ofstream out(path);
+	if (!out)
+		return false;
+
+	out << "seat,game_loop,bot_us,sc2_us\n";
+	for (size_t seat = 0; seat < players.size(); seat++)
+		for (auto const& s : players[seat]->series())
+			out << seat << "," << s.game_loop << "," << s.bot_us << "," << s.sc2_us << "\n";
+
+	return bool(out);
+}
@@ -0,0 +1,51 @@
+#include <relay_trace.h>
+#include <cstring>
+
+using namespace std;
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+TraceWriter::TraceWriter(const string& path) : buffer(TRACE_BUFFER_SIZE) {
+	// The buffer has to be in place before the file is opened
+	out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	out.open(path, ios::binary | ios::trunc);
+	out.write(TRACE_MAGIC, strlen(TRACE_MAGIC));
+	start = chrono::steady_clock::now();
+}
+
+void TraceWriter::record(TraceDirection direction, const string& message) {
+	if (!out.is_open())
+		return;
+
+	uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+	uint32_t len = uint32_t(message.size());
+	out.put(char(direction));
+	out.write(reinterpret_cast<const char*>(&ns), sizeof(ns));
+	out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+	out.write(message.data(), len);
+}
+
+bool load_trace(const string& path, vector<TraceRecord>& records) {
+	ifstream in(path, ios::binary);
+	string magic(strlen(TRACE_MAGIC), '\0');
+	if (!in.read(&magic[0], magic.size()) || magic != TRACE_MAGIC)
+		return false;
+
+	while (true) {
+		TraceRecord r;
+		char direction;
+		uint32_t len;
+		if (!in.get(direction))
+			break;
+		if (!in.read(reinterpret_cast<char*>(&r.ns), sizeof(r.ns)) || !in.read(reinterpret_cast<char*>(&len), sizeof(len)))
+			return false;
+
+		r.direction = TraceDirection(direction);
+		r.message.resize(len);
+		if (len > 0 && !in.read(&r.message[0], len))
+			return false;
+		records.push_back(move(r));
+	}
+
+	return true;
+}
@@ -0,0 +1,167 @@
+#include <replay_archive.h>
+#include <arena_log.h>
+#include <arena_process.h>
+#include <zlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+#define REPLAY_INDEX "index.tsv"
+#define REPLAY_COMPRESSION 6
+
+// Data file for matches started on the same UTC day
+static string day_file(time_t started) {
+	struct tm day;
+#ifdef _WIN32
+	gmtime_s(&day, &started);
+#else
+	gmtime_r(&started, &day);
+#endif
+	char name[32];
+	strftime(name, sizeof(name), "replays-%Y%m%d.dat", &day);
+	return name;
+}
+
+ReplayArchive::ReplayArchive(const string& dir) : dir(dir), index_path(dir + "/" + REPLAY_INDEX) {
+	make_dir(dir);
+	load_index();
+	writer_thread = thread(&ReplayArchive::writer, this);
+}
+
+ReplayArchive::~ReplayArchive() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	queued.notify_all();
+	writer_thread.join();
+}
+
+void ReplayArchive::add(const MatchRecord& match, string replay) {
+	{
+		lock_guard<mutex> guard(lock);
+		pending.push_back({ match, move(replay) });
+	}
+	queued.notify_one();
+}
+
+void ReplayArchive::flush() {
+	unique_lock<mutex> guard(lock);
+	written.wait(guard, [this] { return pending.empty() && !writing; });
+}
+
+void ReplayArchive::writer() {
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		queued.wait(guard, [this] { return !pending.empty() || stopping; });
+		if (pending.empty())
+			return;
+
+		Pending next = move(pending.front());
+		pending.pop_front();
+		writing = true;
+		guard.unlock();
+
+		if (!write(next))
+			LOG_WARN(nullptr, "Failed to archive the replay of " << next.match.map << " started " << next.match.started);
+
+		guard.lock();
+		writing = false;
+		written.notify_all();
+	}
+}
+
+bool ReplayArchive::write(const Pending& p) {
+	uLongf stored = compressBound(uLong(p.replay.size()));
+	string compressed(stored, '\0');
+	if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &stored,
+			reinterpret_cast<const Bytef*>(p.replay.data()), uLong(p.replay.size()), REPLAY_COMPRESSION) != Z_OK)
+		return false;
+
+	ReplayEntry entry;
+	entry.file = day_file(p.match.started);
+	entry.stored_size = stored;
+	entry.size = p.replay.size();
+	entry.started = p.match.started;
+	entry.map = p.match.map;
+	entry.players = p.match.players;
+	entry.result = p.match.result;
+
+	// Data first, so an index line never points past the end of its file
+	ofstream data(dir + "/" + entry.file, ios::binary | ios::app);
+	data.seekp(0, ios::end);
+	entry.offset = uint64_t(data.tellp());
+	data.write(compressed.data(), stored);
+	data.flush();
+	if (!data)
+		return false;
+
+	ofstream index(index_path, ios::app);
+	index << entry.file << "\t" << entry.offset << "\t" << entry.stored_size << "\t" << entry.size << "\t"
+		<< entry.started << "\t" << entry.result << "\t" << entry.map;
+	for (auto const& name : entry.players)
+		index << "\t" << name;
+	index << endl;
+	if (!index)
+		return false;
+
+	lock_guard<mutex> guard(lock);
+	entries.push_back(entry);
+	return true;
+}
+
+void ReplayArchive::load_index() {
+	ifstream in(index_path);
+	string line;
+	while (getline(in, line)) {
+		stringstream ss(line);
+		ReplayEntry entry;
+		string field;
+		vector<string> fields;
+		while (getline(ss, field, '\t'))
+			fields.push_back(field);
+		if (fields.size() < 7)
+			continue;
+
+		entry.file = fields[0];
+		entry.offset = stoull(fields[1]);
+		entry.stored_size = stoull(fields[2]);
+		entry.size = stoull(fields[3]);
+		entry.started = time_t(stoll(fields[4]));
+		entry.result = stoi(fields[5]);
+		entry.map = fields[6];
+		entry.players.assign(fields.begin() + 7, fields.end());
+		entries.push_back(entry);
+	}
+}
+
+vector<ReplayEntry> ReplayArchive::find(const string& bot, const string& map, time_t from, time_t to) {
+	vector<ReplayEntry> found;
+	lock_guard<mutex> guard(lock);
+	for (auto const& e : entries) {
+		if (!map.empty() && e.map != map)
+			continue;
+		if ((from != 0 && e.started < from) || (to != 0 && e.started >= to))
+			continue;
+		if (!bot.empty() && std::find(e.players.begin(), e.players.end(), bot) == e.players.end())
+			continue;
+		found.push_back(e);
+	}
+
+	return found;
+}
+
+bool ReplayArchive::read(const ReplayEntry& entry, string& replay) {
+	ifstream data(dir + "/" + entry.file, ios::binary);
+	data.seekg(streamoff(entry.offset));
+	string compressed(entry.stored_size, '\0');
+	if (!data.read(&compressed[0], compressed.size()))
+		return false;
+
+	replay.resize(entry.size);
+	uLongf size = uLongf(entry.size);
+	return uncompress(reinterpret_cast<Bytef*>(&replay[0]), &size,
+		reinterpret_cast<const Bytef*>(compressed.data()), uLong(compressed.size())) == Z_OK && size == entry.size;
+}
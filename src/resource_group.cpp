@@ -0,0 +1,200 @@
+#include <resource_group.h>
+#include <arena_log.h>
+#include <arena_process.h>
+#include <arena_settings.h>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#define CPU_PERIOD_US 100000
+#define CGROUP_EMPTY_TIMEOUT_MS 2000 // how long removing a group waits for its processes to die
+
+#ifdef __linux__
+static bool write_file(const string& path, const string& value) {
+	ofstream out(path);
+	out << value;
+	out.flush();
+	return bool(out);
+}
+
+// cgroup.kill only sends the signals, the group cannot be removed until
+// every process in it has exited. False if some are still there.
+static bool wait_empty(const string& dir) {
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(CGROUP_EMPTY_TIMEOUT_MS);
+	while (true) {
+		ifstream events(dir + "/cgroup.events");
+		string key;
+		int value;
+		bool populated = false;
+		while (events >> key >> value)
+			if (key == "populated")
+				populated = value != 0;
+		if (!populated)
+			return true;
+		if (chrono::steady_clock::now() >= deadline)
+			return false;
+		this_thread::sleep_for(chrono::milliseconds(5));
+	}
+}
+
+// Groups can only use the controllers their parent hands down. Returns
+// the ones dir could not.
+static vector<string> hand_down(const string& dir) {
+	vector<string> missing;
+	for (string controller : { "cpu", "memory", "cpuset" })
+		if (!write_file(dir + "/cgroup.subtree_control", "+" + controller))
+			missing.push_back(controller);
+
+	return missing;
+}
+
+static bool setup_root() {
+	string root = settings.cgroup_root;
+	if (root.empty())
+		return false;
+	if (!ifstream("/sys/fs/cgroup/cgroup.controllers")) {
+		LOG_WARN(nullptr, "No cgroup v2 hierarchy, bots and sc2 run without resource limits");
+		return false;
+	}
+	if (!make_dir(root)) {
+		LOG_WARN(nullptr, "Could not create cgroup " << root << ", bots and sc2 run without resource limits");
+		return false;
+	}
+
+	for (string controller : hand_down(root))
+		LOG_WARN(nullptr, "The " << controller << " controller is not available in " << root);
+
+	return true;
+}
+
+// Groups pinned to each core the arena may use, -1 for cores it may not
+static mutex cpu_lock;
+static vector<int> cpu_load;
+
+static int pin_cpu() {
+	lock_guard<mutex> guard(cpu_lock);
+	if (cpu_load.empty()) {
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+			return -1;
+		for (int c = 0; c < CPU_SETSIZE; c++) {
+			if (!CPU_ISSET(c, &allowed))
+				continue;
+			cpu_load.resize(c + 1, -1);
+			cpu_load[c] = 0;
+		}
+	}
+
+	int res = -1;
+	for (int c = 0; c < int(cpu_load.size()); c++)
+		if (cpu_load[c] >= 0 && (res < 0 || cpu_load[c] < cpu_load[res]))
+			res = c;
+	if (res >= 0)
+		cpu_load[res]++;
+
+	return res;
+}
+
+static void unpin_cpu(int cpu) {
+	lock_guard<mutex> guard(cpu_lock);
+	cpu_load[cpu]--;
+}
+#endif
+
+bool ResourceGroup::available() {
+#ifdef __linux__
+	static bool res = setup_root();
+	return res;
+#else
+	return false;
+#endif
+}
+
+ResourceGroup::ResourceGroup(const string& name, const ResourceLimits& limits, const ResourceGroup* parent) {
+#ifdef __linux__
+	if (!available())
+		return;
+
+	string under = settings.cgroup_root;
+	if (parent != nullptr && parent->active()) {
+		under = parent->dir;
+		hand_down(under);
+	}
+	string path = under + "/" + name;
+	// Drop an empty group left behind by an earlier run, it still counts
+	// that run's usage
+	rmdir(path.c_str());
+	if (!make_dir(path)) {
+		LOG_WARN(nullptr, "Could not create cgroup " << path);
+		return;
+	}
+	dir = path;
+
+	if (limits.cpu_percent > 0)
+		write_file(dir + "/cpu.max", to_string(limits.cpu_percent * CPU_PERIOD_US / 100) + " " + to_string(CPU_PERIOD_US));
+	if (limits.memory_mb > 0) {
+		write_file(dir + "/memory.max", to_string(uint64_t(limits.memory_mb) * 1024 * 1024));
+		// Past the cap the group is OOM killed instead of swapping
+		write_file(dir + "/memory.swap.max", "0");
+	}
+	if (limits.pin_cpu) {
+		cpu = pin_cpu();
+		if (cpu >= 0 && !write_file(dir + "/cpuset.cpus", to_string(cpu)))
+			LOG_WARN(nullptr, "Could not pin cgroup " << dir << " to cpu " << cpu);
+	}
+#endif
+}
+
+ResourceGroup::~ResourceGroup() {
+#ifdef __linux__
+	if (cpu >= 0)
+		unpin_cpu(cpu);
+	if (active() && (!wait_empty(dir) || rmdir(dir.c_str()) != 0))
+		LOG_WARN(nullptr, "Could not remove cgroup " << dir << ", is something still running in it?");
+#endif
+}
+
+ResourceUsage ResourceGroup::usage(uint64_t pid) const {
+	return usage_at(dir, pid);
+}
+
+ResourceUsage ResourceGroup::usage_at(const string& dir, uint64_t pid) {
+	ResourceUsage res;
+	if (dir.empty()) {
+		proc_usage(pid, res.cpu_ms, res.peak_rss_kb);
+		return res;
+	}
+
+	ifstream stat(dir + "/cpu.stat");
+	string key;
+	uint64_t value;
+	while (stat >> key >> value)
+		if (key == "usage_usec")
+			res.cpu_ms = value / 1000;
+
+	// memory.peak is new in Linux 5.19, before that the best there is
+	// is what the group uses now
+	uint64_t bytes = 0;
+	if ((ifstream(dir + "/memory.peak") >> bytes) || (ifstream(dir + "/memory.current") >> bytes))
+		res.peak_rss_kb = bytes / 1024;
+
+	return res;
+}
+
+bool ResourceGroup::kill() {
+#ifdef __linux__
+	return active() && write_file(dir + "/cgroup.kill", "1");
+#else
+	return false;
+#endif
+}
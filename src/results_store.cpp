@@ -0,0 +1,363 @@
+#include <results_store.h>
+#include <arena_log.h>
+#include <sqlite3.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+#define BATCH_DELAY_MS 500 // how long the writer gathers records before committing
+#define ELO_K 32.0
+#define GLICKO_MIN_RD 30.0
+
+static const char* schema =
+	"CREATE TABLE IF NOT EXISTS players ("
+	"	id INTEGER PRIMARY KEY,"
+	"	name TEXT NOT NULL UNIQUE,"
+	"	elo REAL NOT NULL DEFAULT 1500,"
+	"	glicko REAL NOT NULL DEFAULT 1500,"
+	"	glicko_rd REAL NOT NULL DEFAULT 350,"
+	"	games INTEGER NOT NULL DEFAULT 0,"
+	"	wins INTEGER NOT NULL DEFAULT 0,"
+	"	losses INTEGER NOT NULL DEFAULT 0,"
+	"	draws INTEGER NOT NULL DEFAULT 0);"
+	"CREATE TABLE IF NOT EXISTS maps ("
+	"	id INTEGER PRIMARY KEY,"
+	"	name TEXT NOT NULL UNIQUE);"
+	"CREATE TABLE IF NOT EXISTS matches ("
+	"	id INTEGER PRIMARY KEY,"
+	"	map_id INTEGER NOT NULL REFERENCES maps(id),"
+	"	started INTEGER NOT NULL,"
+	"	duration_ms INTEGER NOT NULL,"
+	"	game_loops INTEGER NOT NULL,"
+	"	result INTEGER NOT NULL);"
+	"CREATE TABLE IF NOT EXISTS match_players ("
+	"	match_id INTEGER NOT NULL REFERENCES matches(id),"
+	"	player_id INTEGER NOT NULL REFERENCES players(id),"
+	"	seat INTEGER NOT NULL,"
+	"	outcome INTEGER NOT NULL,"
+	"	PRIMARY KEY (match_id, seat));"
+	"CREATE TABLE IF NOT EXISTS match_usage ("
+	"	match_id INTEGER NOT NULL REFERENCES matches(id),"
+	"	seat INTEGER NOT NULL,"
+	"	bot_cpu_ms INTEGER NOT NULL,"
+	"	bot_peak_rss_kb INTEGER NOT NULL,"
+	"	sc2_cpu_ms INTEGER NOT NULL,"
+	"	sc2_peak_rss_kb INTEGER NOT NULL,"
+	"	PRIMARY KEY (match_id, seat));"
+	"CREATE INDEX IF NOT EXISTS players_elo ON players(elo DESC);"
+	"CREATE INDEX IF NOT EXISTS matches_map ON matches(map_id, started);"
+	"CREATE INDEX IF NOT EXISTS match_players_player ON match_players(player_id, match_id);";
+
+// Prepared statement that finalizes itself.
+class Statement {
+public:
+	Statement(sqlite3* db, const char* sql) {
+		if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+			LOG_WARN(nullptr, "SQLite: " << sqlite3_errmsg(db));
+			stmt = nullptr;
+		}
+	}
+	~Statement() { sqlite3_finalize(stmt); }
+
+	Statement& bind(int i, int64_t v) { sqlite3_bind_int64(stmt, i, v); return *this; }
+	Statement& bind(int i, double v) { sqlite3_bind_double(stmt, i, v); return *this; }
+	Statement& bind(int i, const string& v) { sqlite3_bind_text(stmt, i, v.c_str(), int(v.size()), SQLITE_TRANSIENT); return *this; }
+	bool step() { return stmt != nullptr && sqlite3_step(stmt) == SQLITE_ROW; }
+	bool run() { return stmt != nullptr && sqlite3_step(stmt) == SQLITE_DONE; }
+	int64_t integer(int col) { return sqlite3_column_int64(stmt, col); }
+	double real(int col) { return sqlite3_column_double(stmt, col); }
+	string text(int col) { return reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)); }
+
+private:
+	sqlite3_stmt* stmt;
+};
+
+ResultsStore::ResultsStore(const string& path) {
+	if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+		LOG_ERROR(nullptr, "Could not open results database " << path << ": " << sqlite3_errmsg(db));
+		sqlite3_close(db);
+		db = nullptr;
+		return;
+	}
+
+	// WAL lets leaderboard queries read while a batch commits
+	exec("PRAGMA journal_mode=WAL;");
+	exec("PRAGMA synchronous=NORMAL;");
+	exec("PRAGMA foreign_keys=ON;");
+	exec(schema);
+	sqlite3_busy_timeout(db, 5000);
+
+	if (sqlite3_open_v2(path.c_str(), &reader, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+		sqlite3_close(reader);
+		reader = nullptr;
+	}
+	else {
+		sqlite3_busy_timeout(reader, 5000);
+	}
+
+	writer_thread = thread(&ResultsStore::writer, this);
+}
+
+ResultsStore::~ResultsStore() {
+	if (writer_thread.joinable()) {
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		queued.notify_all();
+		writer_thread.join();
+	}
+
+	sqlite3_close(reader);
+	sqlite3_close(db);
+}
+
+void ResultsStore::record(const MatchRecord& match) {
+	if (db == nullptr)
+		return;
+
+	{
+		lock_guard<mutex> guard(lock);
+		pending.push_back(match);
+	}
+	queued.notify_one();
+}
+
+void ResultsStore::flush() {
+	unique_lock<mutex> guard(lock);
+	queued.notify_one();
+	written.wait(guard, [this] { return (pending.empty() && in_flight == 0) || db == nullptr; });
+}
+
+void ResultsStore::writer() {
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		queued.wait(guard, [this] { return !pending.empty() || stopping; });
+		if (pending.empty())
+			return;
+
+		// Let records from other slots pile up so they share a commit
+		if (!stopping)
+			queued.wait_for(guard, chrono::milliseconds(BATCH_DELAY_MS), [this] { return stopping; });
+
+		vector<MatchRecord> batch;
+		batch.swap(pending);
+		in_flight = batch.size();
+		guard.unlock();
+
+		if (!write_batch(batch))
+			LOG_ERROR(nullptr, "Failed to store " << batch.size() << " match results: " << sqlite3_errmsg(db));
+
+		guard.lock();
+		in_flight = 0;
+		written.notify_all();
+	}
+}
+
+bool ResultsStore::write_batch(const vector<MatchRecord>& batch) {
+	if (!exec("BEGIN IMMEDIATE;"))
+		return false;
+
+	// One savepoint per match, so a record that fails is dropped alone
+	for (auto const& m : batch) {
+		exec("SAVEPOINT match;");
+		if (write_match(m)) {
+			exec("RELEASE match;");
+			continue;
+		}
+
+		LOG_ERROR(nullptr, "Failed to store the match on " << m.map << " started " << m.started << ": " << sqlite3_errmsg(db));
+		exec("ROLLBACK TO match;");
+		exec("RELEASE match;");
+	}
+
+	if (exec("COMMIT;"))
+		return true;
+	exec("ROLLBACK;");
+	return false;
+}
+
+bool ResultsStore::write_match(const MatchRecord& match) {
+	int64_t map = map_id(match.map);
+	vector<int64_t> ids;
+	for (auto const& p : match.players)
+		ids.push_back(player_id(p));
+	if (map < 0)
+		return false;
+	for (int64_t id : ids)
+		if (id < 0)
+			return false;
+
+	Statement insert(db, "INSERT INTO matches (map_id, started, duration_ms, game_loops, result) VALUES (?, ?, ?, ?, ?);");
+	if (!insert.bind(1, map).bind(2, int64_t(match.started)).bind(3, int64_t(match.duration_ms))
+		.bind(4, int64_t(match.game_loops)).bind(5, int64_t(match.result)).run())
+		return false;
+	int64_t match_id = sqlite3_last_insert_rowid(db);
+
+	// A match that failed on the arena's side is kept for the record but
+	// counts for nobody
+	vector<PlayerOutcome> outcomes;
+	for (size_t i = 0; i < ids.size(); i++)
+		outcomes.push_back(player_outcome(match.result, i, ids.size()));
+	bool rated = find(outcomes.begin(), outcomes.end(), PlayerOutcome::Errored) == outcomes.end();
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		PlayerOutcome outcome = outcomes[i];
+		Statement seat(db, "INSERT INTO match_players (match_id, player_id, seat, outcome) VALUES (?, ?, ?, ?);");
+		if (!seat.bind(1, match_id).bind(2, ids[i]).bind(3, int64_t(i)).bind(4, int64_t(outcome)).run())
+			return false;
+		if (!rated)
+			continue;
+
+		Statement counts(db,
+			"UPDATE players SET games = games + 1, wins = wins + ?, losses = losses + ?, draws = draws + ? WHERE id = ?;");
+		bool win = outcome == PlayerOutcome::Win;
+		bool draw = outcome == PlayerOutcome::Draw;
+		if (!counts.bind(1, int64_t(win)).bind(2, int64_t(!win && !draw)).bind(3, int64_t(draw)).bind(4, ids[i]).run())
+			return false;
+	}
+
+	for (size_t i = 0; i < match.bot_usage.size(); i++) {
+		ResourceUsage sc2 = i < match.sc2_usage.size() ? match.sc2_usage[i] : ResourceUsage();
+		Statement usage(db,
+			"INSERT INTO match_usage (match_id, seat, bot_cpu_ms, bot_peak_rss_kb, sc2_cpu_ms, sc2_peak_rss_kb) VALUES (?, ?, ?, ?, ?, ?);");
+		if (!usage.bind(1, match_id).bind(2, int64_t(i)).bind(3, int64_t(match.bot_usage[i].cpu_ms))
+			.bind(4, int64_t(match.bot_usage[i].peak_rss_kb)).bind(5, int64_t(sc2.cpu_ms)).bind(6, int64_t(sc2.peak_rss_kb)).run())
+			return false;
+	}
+
+	if (rated)
+		update_ratings(match, ids);
+	return true;
+}
+
+int64_t ResultsStore::player_id(const string& name) {
+	Statement(db, "INSERT OR IGNORE INTO players (name) VALUES (?);").bind(1, name).run();
+	Statement select(db, "SELECT id FROM players WHERE name = ?;");
+	return select.bind(1, name).step() ? select.integer(0) : -1;
+}
+
+int64_t ResultsStore::map_id(const string& name) {
+	Statement(db, "INSERT OR IGNORE INTO maps (name) VALUES (?);").bind(1, name).run();
+	Statement select(db, "SELECT id FROM maps WHERE name = ?;");
+	return select.bind(1, name).step() ? select.integer(0) : -1;
+}
+
+// 1 for a win, 0 for anything that is not a win or draw
+static double score(PlayerOutcome outcome) {
+	switch (outcome) {
+	case PlayerOutcome::Win:	return 1.0;
+	case PlayerOutcome::Draw:	return 0.5;
+	default:					return 0.0;
+	}
+}
+
+// Every pair of players is rated as a game between the two.
+void ResultsStore::update_ratings(const MatchRecord& match, const vector<int64_t>& ids) {
+	size_t n = ids.size();
+	vector<double> elo(n), glicko(n), rd(n);
+	for (size_t i = 0; i < n; i++) {
+		Statement select(db, "SELECT elo, glicko, glicko_rd FROM players WHERE id = ?;");
+		if (!select.bind(1, ids[i]).step())
+			return;
+		elo[i] = select.real(0);
+		glicko[i] = select.real(1);
+		rd[i] = select.real(2);
+	}
+
+	const double q = log(10.0) / 400.0;
+	const double pi = 3.14159265358979323846;
+	auto g = [&](double r) { return 1.0 / sqrt(1.0 + 3.0 * q * q * r * r / (pi * pi)); };
+
+	vector<double> new_elo = elo, new_glicko = glicko, new_rd = rd;
+	for (size_t i = 0; i < n; i++) {
+		double inv_d2 = 0, delta = 0;
+		for (size_t j = 0; j < n; j++) {
+			if (i == j)
+				continue;
+
+			double s = 0.5 + (score(player_outcome(match.result, i, n)) - score(player_outcome(match.result, j, n))) / 2;
+
+			double expected = 1.0 / (1.0 + pow(10.0, (elo[j] - elo[i]) / 400.0));
+			new_elo[i] += ELO_K * (s - expected) / double(n - 1);
+
+			double gj = g(rd[j]);
+			double e = 1.0 / (1.0 + pow(10.0, -gj * (glicko[i] - glicko[j]) / 400.0));
+			inv_d2 += q * q * gj * gj * e * (1 - e);
+			delta += gj * (s - e);
+		}
+
+		if (n < 2)
+			continue;
+		double denom = 1.0 / (rd[i] * rd[i]) + inv_d2;
+		new_glicko[i] = glicko[i] + q / denom * delta;
+		new_rd[i] = max(sqrt(1.0 / denom), GLICKO_MIN_RD);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		Statement update(db, "UPDATE players SET elo = ?, glicko = ?, glicko_rd = ? WHERE id = ?;");
+		update.bind(1, new_elo[i]).bind(2, new_glicko[i]).bind(3, new_rd[i]).bind(4, ids[i]).run();
+	}
+}
+
+vector<Rating> ResultsStore::leaderboard(size_t limit) {
+	vector<Rating> res;
+	if (reader == nullptr)
+		return res;
+
+	Statement select(reader,
+		"SELECT name, elo, glicko, glicko_rd, games, wins, losses, draws FROM players ORDER BY elo DESC LIMIT ?;");
+	select.bind(1, int64_t(limit));
+	while (select.step()) {
+		Rating r;
+		r.name = select.text(0);
+		r.elo = select.real(1);
+		r.glicko = select.real(2);
+		r.glicko_rd = select.real(3);
+		r.games = int(select.integer(4));
+		r.wins = int(select.integer(5));
+		r.losses = int(select.integer(6));
+		r.draws = int(select.integer(7));
+		res.push_back(r);
+	}
+
+	return res;
+}
+
+HeadToHead ResultsStore::head_to_head(const string& bot, const string& opponent) {
+	HeadToHead res;
+	if (reader == nullptr)
+		return res;
+
+	Statement select(reader,
+		"SELECT a.outcome, COUNT(*) FROM match_players a"
+		" JOIN match_players b ON b.match_id = a.match_id AND b.seat != a.seat"
+		" JOIN players pa ON pa.id = a.player_id"
+		" JOIN players pb ON pb.id = b.player_id"
+		" WHERE pa.name = ? AND pb.name = ?"
+		" GROUP BY a.outcome;");
+	select.bind(1, bot).bind(2, opponent);
+	while (select.step()) {
+		int count = int(select.integer(1));
+		switch (PlayerOutcome(select.integer(0))) {
+		case PlayerOutcome::Win:	res.wins += count; break;
+		case PlayerOutcome::Draw:	res.draws += count; break;
+		case PlayerOutcome::Errored:	break;
+		default:					res.losses += count; break;
+		}
+	}
+
+	return res;
+}
+
+bool ResultsStore::exec(const char* sql) {
+	char* error = nullptr;
+	if (sqlite3_exec(db, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+		LOG_WARN(nullptr, "SQLite: " << (error ? error : "unknown error"));
+		sqlite3_free(error);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,232 @@
+#include <sc2_pool.h>
+#include <arena_log.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <arena_process.h>
+#include <arena_settings.h>
+#include <arena_types.h>
+
+using namespace std;
+
+Sc2Pool::Sc2Pool(string process_path, string data_version, vector<string> extra_args, PortAllocator& ports, size_t max_instances)
+	: process_path(process_path), data_version(data_version), extra_args(extra_args), ports(ports), max_instances(max_instances) {
+}
+
+Sc2Pool::~Sc2Pool() {
+	for (Sc2Instance* i : all) {
+		delete i->connection;
+		kill_proc(i->pid);
+		reap_proc(i->pid);
+		delete i->group;
+		ports.release(i->port);
+		delete i;
+	}
+}
+
+void Sc2Pool::warm(size_t count) {
+	size_t missing;
+	{
+		lock_guard<mutex> guard(lock);
+		missing = count > idle.size() ? count - idle.size() : 0;
+	}
+	if (missing == 0)
+		return;
+
+	vector<Sc2Instance*> launched = launch(missing);
+	lock_guard<mutex> guard(lock);
+	idle.insert(idle.end(), launched.begin(), launched.end());
+}
+
+vector<Sc2Instance*> Sc2Pool::acquire(size_t count) {
+	vector<Sc2Instance*> res;
+	while (res.size() < count) {
+		Sc2Instance* instance = nullptr;
+		{
+			lock_guard<mutex> guard(lock);
+			if (idle.empty())
+				break;
+			instance = idle.back();
+			idle.pop_back();
+		}
+
+		// An idle instance may have crashed since it was released
+		SC2APIProtocol::Status status;
+		if (ping(instance, status) && (status == SC2APIProtocol::launched || status == SC2APIProtocol::ended))
+			res.push_back(instance);
+		else
+			retire(instance);
+	}
+
+	if (res.size() < count) {
+		vector<Sc2Instance*> launched = launch(count - res.size());
+		res.insert(res.end(), launched.begin(), launched.end());
+	}
+
+	return res;
+}
+
+void Sc2Pool::release(Sc2Instance* instance) {
+	if (instance->games >= settings.sc2_max_games || !reset(instance)) {
+		retire(instance);
+		return;
+	}
+
+	lock_guard<mutex> guard(lock);
+	idle.push_back(instance);
+}
+
+vector<uint64_t> Sc2Pool::pids() {
+	lock_guard<mutex> guard(lock);
+	vector<uint64_t> res;
+	for (Sc2Instance* i : all)
+		res.push_back(i->pid);
+
+	return res;
+}
+
+bool Sc2Pool::call(Sc2Instance* instance, SC2APIProtocol::Request& request, SC2APIProtocol::Response& response) {
+	static atomic<uint32_t> next_id(1);
+	uint32_t id = next_id++;
+	request.set_id(id);
+	if (!instance->connection->send(request))
+		return false;
+
+	// Skip anything a relay left unread. sc2 builds that predate request
+	// ids answer with id 0, and so does every response to a bot that did
+	// not set one, so those only count if they answer the same kind of
+	// request. Request and Response number their oneof cases alike.
+	while (instance->connection->receive(response, chrono::milliseconds(settings.game_timeout_ms))) {
+		if (response.id() == id)
+			return true;
+		if (response.id() == 0 && int(response.response_case()) == int(request.request_case()))
+			return true;
+	}
+
+	return false;
+}
+
+bool Sc2Pool::ping(Sc2Instance* instance, SC2APIProtocol::Status& status) {
+	SC2APIProtocol::Request request;
+	request.mutable_ping();
+	SC2APIProtocol::Response response;
+	if (!call(instance, request, response) || !response.has_ping())
+		return false;
+
+	status = response.status();
+	return true;
+}
+
+vector<Sc2Instance*> Sc2Pool::launch(size_t count) {
+	vector<Sc2Instance*> started;
+	for (size_t i = 0; i < count; i++) {
+		{
+			lock_guard<mutex> guard(lock);
+			if (instances >= max_instances) {
+				LOG_WARN(nullptr, "Sc2 pool is full at " << max_instances << " instances");
+				break;
+			}
+			instances++;
+		}
+		int port = ports.lease(1);
+		if (port == 0) {
+			LOG_WARN(nullptr, "No free port for another sc2 instance");
+			lock_guard<mutex> guard(lock);
+			instances--;
+			break;
+		}
+
+		Sc2Instance* instance = new Sc2Instance();
+		instance->port = port;
+		instance->games = 0;
+		instance->connection = new GameConnection();
+		vector<string> args = {
+			"-listen", BOT_HOST,
+			"-port", to_string(port),
+			"-displayMode", "0",
+			"-dataVersion", data_version };
+		args.insert(args.end(), extra_args.begin(), extra_args.end());
+		ResourceLimits limits;
+		limits.cpu_percent = settings.sc2_cpu_percent;
+		limits.memory_mb = settings.sc2_memory_limit_mb;
+		limits.pin_cpu = settings.pin_cpus;
+		instance->group = new ResourceGroup("sc2_" + to_string(port), limits);
+		instance->pid = start_proc(process_path, args, instance->group->path());
+		LOG_INFO(nullptr, "Starting SC2, PID:" << instance->pid << ", port:" << port);
+		started.push_back(instance);
+
+		lock_guard<mutex> guard(lock);
+		all.push_back(instance);
+	}
+	if (started.empty())
+		return started;
+
+	// Instances start side by side, so one deadline covers the batch
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(settings.sc2_start_timeout_ms);
+	vector<Sc2Instance*> res;
+	for (Sc2Instance* instance : started) {
+		if (wait_ready(instance, deadline))
+			res.push_back(instance);
+		else
+			retire(instance);
+	}
+
+	return res;
+}
+
+bool Sc2Pool::wait_ready(Sc2Instance* instance, chrono::steady_clock::time_point deadline) {
+	auto backoff = chrono::milliseconds(50);
+	while (true) {
+		if (proc_exited(instance->pid)) {
+			LOG_WARN(nullptr, "SC2 PID:" << instance->pid << " exited during startup");
+			return false;
+		}
+
+		SC2APIProtocol::Status status;
+		if (instance->connection->connect(BOT_HOST, instance->port, false) && ping(instance, status)) {
+			LOG_INFO(nullptr, "SC2 PID:" << instance->pid << " ready");
+			return true;
+		}
+
+		if (chrono::steady_clock::now() + backoff > deadline) {
+			LOG_WARN(nullptr, "SC2 PID:" << instance->pid << " did not answer a ping on port "
+				<< instance->port << " within " << settings.sc2_start_timeout_ms << "ms");
+			return false;
+		}
+		this_thread::sleep_for(backoff);
+		backoff = min(backoff * 2, chrono::milliseconds(1000));
+	}
+}
+
+bool Sc2Pool::reset(Sc2Instance* instance) {
+	SC2APIProtocol::Status status;
+	if (!ping(instance, status))
+		return false;
+
+	// Multiplayer games are left rather than restarted; sc2 goes back to
+	// launched and accepts the next create_game.
+	if (status == SC2APIProtocol::in_game) {
+		SC2APIProtocol::Request request;
+		request.mutable_leave_game();
+		SC2APIProtocol::Response response;
+		if (!call(instance, request, response) || !ping(instance, status))
+			return false;
+	}
+
+	return status == SC2APIProtocol::launched || status == SC2APIProtocol::ended;
+}
+
+void Sc2Pool::retire(Sc2Instance* instance) {
+	LOG_INFO(nullptr, "Retiring SC2, PID:" << instance->pid);
+	delete instance->connection;
+	instance->group->kill();
+	kill_proc(instance->pid);
+	reap_proc(instance->pid);
+	delete instance->group;
+
+	lock_guard<mutex> guard(lock);
+	all.erase(remove(all.begin(), all.end(), instance), all.end());
+	instances--;
+	ports.release(instance->port);
+	delete instance;
+}
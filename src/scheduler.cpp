@@ -0,0 +1,99 @@
+#include <scheduler.h>
+#include <arena_log.h>
+#include <arena_settings.h>
+#include <algorithm>
+
+using namespace std;
+
+Scheduler::Scheduler(size_t slots, size_t players_per_match) {
+	if (slots == 0)
+		slots = default_slots(players_per_match);
+
+	LOG_INFO(nullptr, "Scheduling matches on " << slots << " slots");
+	// Launch every slot's sc2 up front, matches then start on warm instances
+	Arena::pool->warm(slots * players_per_match);
+	for (size_t i = 0; i < slots; i++)
+		workers.emplace_back(&Scheduler::worker, this, i);
+}
+
+Scheduler::~Scheduler() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	queued.notify_all();
+	for (auto& t : workers)
+		t.join();
+}
+
+void Scheduler::on_finished(function<void(const MatchOutcome&)> callback) {
+	lock_guard<mutex> guard(lock);
+	finished = callback;
+}
+
+void Scheduler::record_to(ResultsStore* store) {
+	lock_guard<mutex> guard(lock);
+	results = store;
+}
+
+void Scheduler::enqueue(const MatchSpec& spec) {
+	{
+		lock_guard<mutex> guard(lock);
+		pending.push_back(spec);
+	}
+	queued.notify_one();
+}
+
+void Scheduler::wait() {
+	unique_lock<mutex> guard(lock);
+	idle.wait(guard, [this] { return pending.empty() && active == 0; });
+}
+
+size_t Scheduler::default_slots(size_t players_per_match) {
+	players_per_match = max<size_t>(players_per_match, 1);
+	size_t cores = max<unsigned>(thread::hardware_concurrency(), 1);
+	size_t by_cpu = cores / players_per_match;
+	size_t by_memory = physical_memory_mb() / (size_t(settings.sc2_memory_mb) * players_per_match);
+
+	return max<size_t>(min(by_cpu, by_memory), 1);
+}
+
+void Scheduler::worker(size_t slot) {
+	while (true) {
+		MatchSpec spec;
+		function<void(const MatchOutcome&)> callback;
+		ResultsStore* store;
+		{
+			unique_lock<mutex> guard(lock);
+			queued.wait(guard, [this] { return !pending.empty() || stopping; });
+			if (pending.empty())
+				return;
+
+			spec = pending.front();
+			pending.pop_front();
+			callback = finished;
+			store = results;
+			active++;
+		}
+
+		Match match;
+		match.bots = spec.bots;
+		match.map = spec.map;
+
+		Arena::play(match);
+		MatchOutcome outcome;
+		outcome.spec = spec;
+		outcome.record = match.record;
+
+		if (store != nullptr)
+			store->record(outcome.record);
+		if (callback)
+			callback(outcome);
+
+		{
+			lock_guard<mutex> guard(lock);
+			active--;
+		}
+		idle.notify_all();
+	}
+}
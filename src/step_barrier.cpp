@@ -0,0 +1,79 @@
+#include <step_barrier.h>
+
+using namespace std;
+
+StepBarrier::StepBarrier(const vector<GameConnection*>& connections) : seats(connections.size()) {
+	for (size_t i = 0; i < connections.size(); i++)
+		seats[i].connection = connections[i];
+	active = seats.size();
+}
+
+bool StepBarrier::arrive(size_t seat, string& step) {
+	auto now = chrono::steady_clock::now();
+	lock_guard<mutex> guard(lock);
+	Seat& s = seats[seat];
+	if (!s.active || s.held)
+		return false;
+
+	if (held == 0)
+		first = now;
+	s.step.swap(step);
+	s.held = true;
+	held++;
+	last = seat;
+	release_if_ready(now);
+	return true;
+}
+
+void StepBarrier::leave(size_t seat) {
+	lock_guard<mutex> guard(lock);
+	Seat& s = seats[seat];
+	if (!s.active)
+		return;
+
+	s.active = false;
+	active--;
+	if (s.held) {
+		s.held = false;
+		held--;
+	}
+	release_if_ready(chrono::steady_clock::now());
+}
+
+chrono::steady_clock::time_point StepBarrier::dispatched(size_t seat) {
+	lock_guard<mutex> guard(lock);
+	return seats[seat].dispatched;
+}
+
+uint64_t StepBarrier::slowest(size_t seat) {
+	lock_guard<mutex> guard(lock);
+	return seats[seat].slowest;
+}
+
+void StepBarrier::release_if_ready(chrono::steady_clock::time_point now) {
+	if (held == 0 || held < active)
+		return;
+
+	// Sent under the lock so a seat cannot arrive for the next loop
+	// before this one is out; each send is a single websocket write
+	wait.record(now - first);
+	seats[last].slowest++;
+	for (Seat& s : seats) {
+		if (!s.held)
+			continue;
+		s.held = false;
+		s.dispatched = now;
+		s.connection->send(s.step);
+		s.step.clear();
+	}
+	held = 0;
+}
+
+void StepBarrier::print_summary(ostream& out, const vector<string>& names) {
+	lock_guard<mutex> guard(lock);
+	out << "lockstep: " << wait.count() << " loops, waiting on the slowest player avg " << wait.mean_ms()
+		<< "ms, p50 " << wait.quantile_ms(0.5) << "ms, p99 " << wait.quantile_ms(0.99)
+		<< "ms, max " << wait.max_us() / 1000.0 << "ms, " << wait.total_us() / 1000 << "ms in all" << endl;
+	for (size_t i = 0; i < seats.size() && i < names.size(); i++)
+		out << "  " << names[i] << " was the slowest in " << seats[i].slowest << " loops" << endl;
+}
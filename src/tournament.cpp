@@ -0,0 +1,340 @@
+#include <tournament.h>
+#include <arena_log.h>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+#define CHECKPOINT_MAGIC "sc2arena-tournament"
+#define MATCH_RETRIES 2 // times a match that failed on the arena's side is played again
+
+// 0 or 1 for the winning seat, -1 for a draw. Arena results only know
+// the players by seat.
+static int winning_seat(int result) {
+	if (result & ArenaResult::Player1Win)
+		return 0;
+	if (result & ArenaResult::Player2Win)
+		return 1;
+
+	bool lost[2] = {
+		(result & (ArenaResult::Player1Crash | ArenaResult::Player1Forfeit)) != 0,
+		(result & (ArenaResult::Player2Crash | ArenaResult::Player2Forfeit)) != 0
+	};
+	if (lost[0] != lost[1])
+		return lost[0] ? 1 : 0;
+
+	return -1;
+}
+
+// The match failed on the arena's side, nobody won or lost it
+static bool errored(int result) {
+	return player_outcome(result, 0, 2) == PlayerOutcome::Errored;
+}
+
+Tournament::Tournament(TournamentType type, vector<Bot> bots, vector<string> maps, string checkpoint_path)
+	: type(type), bots(bots), maps(maps), checkpoint_path(checkpoint_path) {
+	if (bots.size() < 2 || maps.empty()) {
+		LOG_WARN(nullptr, "A tournament needs at least two bots and a map");
+		return;
+	}
+
+	switch (type) {
+	case TournamentType::RoundRobin:	build_round_robin(); break;
+	case TournamentType::SingleElim:	build_single_elim(); break;
+	case TournamentType::DoubleElim:	build_double_elim(); break;
+	}
+
+	load_checkpoint();
+}
+
+int Tournament::add_match(Seat a, Seat b, const string& map) {
+	TournamentMatch m;
+	m.id = int(matches.size());
+	m.map = map;
+	m.seats[0] = a;
+	m.seats[1] = b;
+	matches.push_back(m);
+	return m.id;
+}
+
+vector<int> Tournament::add_round(const vector<Seat>& seats, const string& map) {
+	vector<int> ids;
+	for (size_t i = 0; i + 1 < seats.size(); i += 2)
+		ids.push_back(add_match(seats[i], seats[i + 1], map));
+
+	return ids;
+}
+
+void Tournament::build_round_robin() {
+	// Every pairing on every map, none depend on each other
+	for (auto const& map : maps)
+		for (size_t i = 0; i < bots.size(); i++)
+			for (size_t j = i + 1; j < bots.size(); j++)
+				add_match({ Seat::Player, int(i) }, { Seat::Player, int(j) }, map);
+}
+
+// Adds the winners bracket and returns the final's id. rounds gets the
+// match ids of each round. Maps rotate by round.
+vector<int> Tournament::build_winners_bracket(vector<vector<int>>& rounds) {
+	size_t size = 1;
+	while (size < bots.size())
+		size *= 2;
+
+	// Seed i meets seed size - 1 - i, missing seeds are byes
+	vector<Seat> seats;
+	for (size_t i = 0; i < size / 2; i++) {
+		size_t other = size - 1 - i;
+		seats.push_back({ Seat::Player, int(i) });
+		seats.push_back(other < bots.size() ? Seat{ Seat::Player, int(other) } : Seat{ Seat::Bye, -1 });
+	}
+
+	vector<int> round = add_round(seats, maps[0]);
+	rounds.push_back(round);
+	while (round.size() > 1) {
+		seats.clear();
+		for (int id : round)
+			seats.push_back(winner_of(id));
+		round = add_round(seats, maps[rounds.size() % maps.size()]);
+		rounds.push_back(round);
+	}
+
+	return round;
+}
+
+void Tournament::build_single_elim() {
+	vector<vector<int>> rounds;
+	final_match = build_winners_bracket(rounds)[0];
+}
+
+void Tournament::build_double_elim() {
+	vector<vector<int>> rounds;
+	int winners_final = build_winners_bracket(rounds)[0];
+
+	// Losers bracket: first round losers play each other, then each
+	// winners round drops its losers in against the losers bracket
+	// survivors, who play down to one between drops.
+	size_t map = rounds.size();
+	vector<Seat> survivors;
+	for (int id : rounds[0])
+		survivors.push_back(loser_of(id));
+
+	// Halves the survivors, once between drops
+	auto consolidate = [&]() {
+		if (survivors.size() < 2)
+			return;
+		vector<int> round = add_round(survivors, maps[map++ % maps.size()]);
+		survivors.clear();
+		for (int id : round)
+			survivors.push_back(winner_of(id));
+	};
+
+	consolidate();
+	for (size_t r = 1; r < rounds.size(); r++) {
+		// Drop in reverse order so early rematches are less likely
+		vector<Seat> seats;
+		for (size_t j = 0; j < survivors.size(); j++) {
+			seats.push_back(survivors[j]);
+			seats.push_back(loser_of(rounds[r][rounds[r].size() - 1 - j]));
+		}
+		vector<int> round = add_round(seats, maps[map++ % maps.size()]);
+		survivors.clear();
+		for (int id : round)
+			survivors.push_back(winner_of(id));
+		consolidate();
+	}
+
+	// Single grand final, no bracket reset
+	final_match = add_match(winner_of(winners_final), survivors[0], maps[map % maps.size()]);
+}
+
+// Finds the bot for a seat. False if it depends on an unplayed match.
+bool Tournament::resolve(Seat seat, int& player) const {
+	switch (seat.kind) {
+	case Seat::Player:
+		player = seat.index;
+		return true;
+	case Seat::Bye:
+		player = -1;
+		return true;
+	case Seat::Winner:
+	case Seat::Loser:
+		if (!matches[seat.index].done)
+			return false;
+		player = seat.kind == Seat::Winner ? matches[seat.index].winner : matches[seat.index].loser;
+		return true;
+	}
+
+	return false;
+}
+
+void Tournament::finish(TournamentMatch& match, int result) {
+	match.done = true;
+	match.result = result;
+
+	// A bye is a walkover
+	if (match.players[0] < 0 || match.players[1] < 0) {
+		match.winner = match.players[0] >= 0 ? match.players[0] : match.players[1];
+		match.loser = -1;
+		return;
+	}
+
+	// Draws go to the better seed. Bots are seeded in config order, so
+	// the lower bot index; past the first round the seats no longer say
+	int seat = winning_seat(result);
+	if (seat < 0)
+		seat = match.players[0] < match.players[1] ? 0 : 1;
+	match.winner = match.players[seat];
+	match.loser = match.players[1 - seat];
+}
+
+// Queues every match whose players are now known. Byes are settled on
+// the spot, which may make more matches ready. Without a scheduler only
+// byes are settled.
+void Tournament::schedule_ready(Scheduler* scheduler) {
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		for (auto& m : matches) {
+			if (m.scheduled || m.done)
+				continue;
+			if (!resolve(m.seats[0], m.players[0]) || !resolve(m.seats[1], m.players[1]))
+				continue;
+
+			if (m.players[0] < 0 || m.players[1] < 0) {
+				m.scheduled = true;
+				finish(m, ArenaResult::None);
+				progress = true;
+				continue;
+			}
+			if (scheduler == nullptr)
+				continue;
+
+			m.scheduled = true;
+			MatchSpec spec;
+			spec.bots = { bots[m.players[0]], bots[m.players[1]] };
+			spec.map = m.map;
+			spec.id = m.id;
+			scheduler->enqueue(spec);
+		}
+	}
+}
+
+void Tournament::run(Scheduler& scheduler) {
+	scheduler.on_finished([this, &scheduler](const MatchOutcome& outcome) {
+		lock_guard<mutex> guard(lock);
+		TournamentMatch& m = matches[outcome.spec.id];
+		// Left unfinished and out of the checkpoint, so even once the
+		// retries are used up a restart plays it again
+		if (errored(outcome.record.result)) {
+			if (++m.attempts > MATCH_RETRIES) {
+				LOG_ERROR(nullptr, "Match " << m.id << " on " << m.map << " failed " << m.attempts
+					<< " times, giving up on it and the matches that depend on it");
+				return;
+			}
+			LOG_WARN(nullptr, "Match " << m.id << " on " << m.map << " failed, playing it again");
+			scheduler.enqueue(outcome.spec);
+			return;
+		}
+		finish(m, outcome.record.result);
+		save_checkpoint(m);
+		LOG_INFO(nullptr, "Match " << m.id << " " << bots[m.players[0]].name << " vs "
+			<< bots[m.players[1]].name << " on " << m.map << ": "
+			<< bots[m.winner].name << " advances");
+		schedule_ready(&scheduler);
+	});
+
+	{
+		lock_guard<mutex> guard(lock);
+		schedule_ready(&scheduler);
+	}
+	scheduler.wait();
+}
+
+int Tournament::champion() const {
+	if (final_match < 0 || !matches[final_match].done)
+		return -1;
+
+	return matches[final_match].winner;
+}
+
+vector<double> Tournament::standings() const {
+	vector<double> wins(bots.size(), 0);
+	for (auto const& m : matches) {
+		if (!m.done || m.players[0] < 0 || m.players[1] < 0)
+			continue;
+
+		int seat = winning_seat(m.result);
+		if (seat < 0) {
+			wins[m.players[0]] += 0.5;
+			wins[m.players[1]] += 0.5;
+		}
+		else {
+			wins[m.players[seat]] += 1;
+		}
+	}
+
+	return wins;
+}
+
+// The checkpoint is a header naming the tournament followed by one
+// "match_id result" line per played match. Winners are rebuilt from the
+// results, so the same bots, maps and type must be used to resume.
+static string checkpoint_header(TournamentType type, const vector<Bot>& bots, const vector<string>& maps) {
+	stringstream ss;
+	ss << CHECKPOINT_MAGIC << " " << int(type);
+	for (auto const& b : bots)
+		ss << " " << b.name;
+	for (auto const& m : maps)
+		ss << " " << m;
+
+	return ss.str();
+}
+
+void Tournament::load_checkpoint() {
+	ifstream in(checkpoint_path);
+	if (!in)
+		return;
+
+	string header;
+	getline(in, header);
+	if (header != checkpoint_header(type, bots, maps)) {
+		LOG_WARN(nullptr, "Ignoring checkpoint " << checkpoint_path << ", it is for a different tournament and will be replaced");
+		stale_checkpoint = true;
+		return;
+	}
+
+	// Matches were appended in the order they finished, so every match a
+	// line depends on has been read before it.
+	int id, result, played = 0;
+	schedule_ready(nullptr);
+	while (in >> id >> result) {
+		// Older checkpoints may hold failed matches, they are played again
+		if (id < 0 || id >= int(matches.size()) || errored(result))
+			continue;
+
+		TournamentMatch& m = matches[id];
+		if (!resolve(m.seats[0], m.players[0]) || !resolve(m.seats[1], m.players[1]))
+			continue;
+		m.scheduled = true;
+		finish(m, result);
+		schedule_ready(nullptr);
+		played++;
+	}
+
+	LOG_INFO(nullptr, "Resuming tournament, " << played << " of " << matches.size() << " matches already played");
+}
+
+void Tournament::save_checkpoint(const TournamentMatch& match) {
+	if (checkpoint_path.empty())
+		return;
+
+	// Another tournament's results are dropped rather than mixed in
+	bool fresh = stale_checkpoint || !ifstream(checkpoint_path).good();
+	ofstream out(checkpoint_path, fresh ? ios::trunc : ios::app);
+	if (fresh)
+		out << checkpoint_header(type, bots, maps) << "\n";
+	stale_checkpoint = false;
+
+	// Flushed per line so a crash loses at most the match in flight
+	out << match.id << " " << match.result << endl;
+}
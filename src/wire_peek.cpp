@@ -0,0 +1,159 @@
+#include <wire_peek.h>
+#include <google/protobuf/io/coded_stream.h>
+
+using namespace std;
+using google::protobuf::io::CodedInputStream;
+
+// Field numbers from s2clientprotocol/sc2api.proto
+enum {
+	FIELD_RESPONSE_JOIN_GAME = 2,
+	FIELD_RESPONSE_OBSERVATION = 10,
+	FIELD_RESPONSE_ID = 97,
+	FIELD_RESPONSE_STATUS = 99,
+	FIELD_OBSERVATION_OBSERVATION = 3,
+	FIELD_OBSERVATION_PLAYER_RESULT = 4,
+	FIELD_OBSERVATION_GAME_LOOP = 9,
+	FIELD_JOIN_GAME_PLAYER_ID = 1,
+	FIELD_PLAYER_RESULT_PLAYER_ID = 1,
+	FIELD_PLAYER_RESULT_RESULT = 2,
+};
+
+enum {
+	WIRE_VARINT = 0,
+	WIRE_FIXED64 = 1,
+	WIRE_LENGTH = 2,
+	WIRE_FIXED32 = 5,
+};
+
+static bool skip_field(CodedInputStream& in, uint32_t tag) {
+	uint64_t varint;
+	uint32_t len;
+	switch (tag & 7) {
+	case WIRE_VARINT:	return in.ReadVarint64(&varint);
+	case WIRE_FIXED64:	return in.Skip(8);
+	case WIRE_LENGTH:	return in.ReadVarint32(&len) && in.Skip(int(len));
+	case WIRE_FIXED32:	return in.Skip(4);
+	default:			return false; // groups are not used by the sc2 protocol
+	}
+}
+
+static bool read_varint(CodedInputStream& in, uint32_t tag, uint32_t& value) {
+	if ((tag & 7) != WIRE_VARINT)
+		return skip_field(in, tag);
+
+	return in.ReadVarint32(&value);
+}
+
+// Runs visit over each field of the length-delimited message at the
+// current position.
+template <typename F>
+static bool read_message(CodedInputStream& in, uint32_t tag, F visit) {
+	uint32_t len;
+	if ((tag & 7) != WIRE_LENGTH || !in.ReadVarint32(&len))
+		return false;
+
+	auto limit = in.PushLimit(int(len));
+	while (uint32_t t = in.ReadTag()) {
+		if (!visit(t))
+			return false;
+	}
+	bool ok = in.ConsumedEntireMessage();
+	in.PopLimit(limit);
+	return ok;
+}
+
+SC2APIProtocol::Request::RequestCase peek_request(const string& request) {
+	return peek_request(request.data(), request.size());
+}
+
+SC2APIProtocol::Request::RequestCase peek_request(const char* data, size_t len) {
+	CodedInputStream in(reinterpret_cast<const uint8_t*>(data), int(len));
+	while (uint32_t tag = in.ReadTag()) {
+		uint32_t field = tag >> 3;
+		// Everything below id is part of the request oneof
+		if (field < FIELD_RESPONSE_ID)
+			return SC2APIProtocol::Request::RequestCase(field);
+		if (!skip_field(in, tag))
+			break;
+	}
+
+	return SC2APIProtocol::Request::REQUEST_NOT_SET;
+}
+
+bool peek_response(const string& response, ResponsePeek& peek) {
+	peek.type = SC2APIProtocol::Response::RESPONSE_NOT_SET;
+	peek.status = 0;
+	peek.has_game_loop = false;
+	peek.game_loop = 0;
+	peek.player_id = 0;
+	peek.has_results = false;
+	for (auto& r : peek.results)
+		r = 0;
+
+	auto visit_player_result = [&](CodedInputStream& in, uint32_t tag) {
+		uint32_t player_id = 0, result = 0;
+		bool ok = read_message(in, tag, [&](uint32_t t) {
+			switch (t >> 3) {
+			case FIELD_PLAYER_RESULT_PLAYER_ID:	return read_varint(in, t, player_id);
+			case FIELD_PLAYER_RESULT_RESULT:	return read_varint(in, t, result);
+			default:							return skip_field(in, t);
+			}
+		});
+		if (ok && player_id > 0 && player_id <= MAX_PLAYERS) {
+			peek.results[player_id] = int(result);
+			peek.has_results = true;
+		}
+		return ok;
+	};
+
+	auto visit_observation = [&](CodedInputStream& in, uint32_t tag) {
+		return read_message(in, tag, [&](uint32_t t) {
+			switch (t >> 3) {
+			case FIELD_OBSERVATION_OBSERVATION:
+				return read_message(in, t, [&](uint32_t u) {
+					if ((u >> 3) != FIELD_OBSERVATION_GAME_LOOP)
+						return skip_field(in, u);
+					peek.has_game_loop = true;
+					return read_varint(in, u, peek.game_loop);
+				});
+			case FIELD_OBSERVATION_PLAYER_RESULT:
+				return visit_player_result(in, t);
+			default:
+				return skip_field(in, t);
+			}
+		});
+	};
+
+	CodedInputStream in(reinterpret_cast<const uint8_t*>(response.data()), int(response.size()));
+	while (uint32_t tag = in.ReadTag()) {
+		uint32_t field = tag >> 3;
+		bool ok;
+		if (field == FIELD_RESPONSE_STATUS) {
+			uint32_t status = 0;
+			ok = read_varint(in, tag, status);
+			peek.status = int(status);
+		}
+		else if (field == FIELD_RESPONSE_JOIN_GAME) {
+			peek.type = SC2APIProtocol::Response::kJoinGame;
+			ok = read_message(in, tag, [&](uint32_t t) {
+				if ((t >> 3) != FIELD_JOIN_GAME_PLAYER_ID)
+					return skip_field(in, t);
+				return read_varint(in, t, peek.player_id);
+			});
+		}
+		else if (field == FIELD_RESPONSE_OBSERVATION) {
+			peek.type = SC2APIProtocol::Response::kObservation;
+			ok = visit_observation(in, tag);
+		}
+		else {
+			if (field < FIELD_RESPONSE_ID)
+				peek.type = SC2APIProtocol::Response::ResponseCase(field);
+			ok = skip_field(in, tag);
+		}
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}